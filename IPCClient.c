@@ -15,13 +15,29 @@ ipc_client_new(int fd)
   // Initialize struct
   memset(&c->event, 0, sizeof(struct epoll_event));
 
-  c->buffer_size = 0;
-  c->buffer = NULL;
+  c->recv_state = IPC_RECV_HEADER;
+  c->recv_type = 0;
+  c->recv_size = 0;
+  c->recv_len = 0;
+  c->recv_buf = NULL;
+  c->queue = NULL;
+  c->queue_head = 0;
+  c->queue_len = 0;
+  c->queue_cap = 0;
+  c->queue_bytes = 0;
+  c->bytes_queued = 0;
+  c->events_dropped = 0;
   c->fd = fd;
   c->event.data.fd = fd;
   c->next = NULL;
   c->prev = NULL;
   c->subscriptions = 0;
+  c->monitor = -1;
+  c->fields = UINT32_MAX;
+  c->encoding = 0;        // IPC_ENCODING_COMPACT
+  c->reply_encoding = 1;  // IPC_ENCODING_PRETTY
+  c->caps = 0;
+  c->dropping = 0;
 
   return c;
 }
@@ -64,3 +80,89 @@ ipc_list_get_client(IPCClientList list, int fd)
 
   return NULL;
 }
+
+void
+ipc_message_unref(IPCMessage *msg)
+{
+  if (--msg->refs == 0) free(msg);
+}
+
+void
+ipc_client_queue_push(IPCClient *c, IPCMessage *msg)
+{
+  if (c->queue_len == c->queue_cap) {
+    // Grow the ring, unwrapping it so the oldest entry is first again
+    unsigned int cap = c->queue_cap ? c->queue_cap * 2 : 8;
+    IPCQueueEntry *queue = ecalloc(cap, sizeof(IPCQueueEntry));
+
+    for (unsigned int i = 0; i < c->queue_len; i++)
+      queue[i] = c->queue[(c->queue_head + i) % c->queue_cap];
+    free(c->queue);
+    c->queue = queue;
+    c->queue_cap = cap;
+    c->queue_head = 0;
+  }
+
+  IPCQueueEntry *e = &c->queue[(c->queue_head + c->queue_len) % c->queue_cap];
+  e->msg = msg;
+  e->offset = 0;
+  msg->refs++;
+  c->queue_len++;
+  c->queue_bytes += msg->size;
+  c->bytes_queued += msg->size;
+}
+
+IPCQueueEntry *
+ipc_client_queue_at(IPCClient *c, unsigned int i)
+{
+  return &c->queue[(c->queue_head + i) % c->queue_cap];
+}
+
+void
+ipc_client_queue_remove(IPCClient *c, unsigned int i)
+{
+  IPCQueueEntry *e = ipc_client_queue_at(c, i);
+
+  c->queue_bytes -= e->msg->size - e->offset;
+  ipc_message_unref(e->msg);
+
+  // Close the gap by moving the newer entries one slot towards the head
+  for (; i + 1 < c->queue_len; i++)
+    *ipc_client_queue_at(c, i) = *ipc_client_queue_at(c, i + 1);
+  c->queue_len--;
+}
+
+void
+ipc_client_queue_consume(IPCClient *c, size_t n)
+{
+  while (n > 0 && c->queue_len > 0) {
+    IPCQueueEntry *e = &c->queue[c->queue_head];
+    const uint32_t left = e->msg->size - e->offset;
+
+    if (n < left) {
+      e->offset += n;
+      c->queue_bytes -= n;
+      return;
+    }
+
+    n -= left;
+    c->queue_bytes -= left;
+    ipc_message_unref(e->msg);
+    c->queue_head = (c->queue_head + 1) % c->queue_cap;
+    c->queue_len--;
+  }
+}
+
+void
+ipc_client_queue_clear(IPCClient *c)
+{
+  for (unsigned int i = 0; i < c->queue_len; i++)
+    ipc_message_unref(c->queue[(c->queue_head + i) % c->queue_cap].msg);
+
+  free(c->queue);
+  c->queue = NULL;
+  c->queue_head = 0;
+  c->queue_len = 0;
+  c->queue_cap = 0;
+  c->queue_bytes = 0;
+}
@@ -1,10 +1,44 @@
 #ifndef IPC_CLIENT_H_
 #define IPC_CLIENT_H_
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/epoll.h>
 
+/**
+ * A complete IPC packet, header followed by payload. A message is immutable
+ * once created and reference counted, so a single event can be queued on every
+ * subscribed client without copying it.
+ */
+typedef struct IPCMessage {
+  unsigned int refs;
+  int event;  // IPCEvent of an event message, 0 for anything else
+  int mon;    // Monitor number the event is about, -1 if none
+  uint32_t size;
+  char data[];
+} IPCMessage;
+
+/**
+ * An entry of a client's output queue, offset is the number of bytes of the
+ * message already written to the client
+ */
+typedef struct IPCQueueEntry {
+  IPCMessage *msg;
+  uint32_t offset;
+} IPCQueueEntry;
+
+// Size of the packed dwm_ipc_header_t: magic, uint32_t size and uint8_t type
+#define IPC_HEADER_SIZE 12
+
+/**
+ * Progress of the message currently being received from a client
+ */
+typedef enum IPCRecvState {
+  IPC_RECV_HEADER = 0,  // Collecting the header into recv_header
+  IPC_RECV_PAYLOAD = 1  // Collecting recv_size bytes of payload into recv_buf
+} IPCRecvState;
+
 typedef struct IPCClient IPCClient;
 /**
  * This structure contains the details of an IPC Client and pointers for a
@@ -13,9 +47,31 @@ typedef struct IPCClient IPCClient;
 struct IPCClient {
   int fd;
   int subscriptions;
+  int monitor;      // Only events about this monitor, -1 for all monitors
+  uint32_t fields;  // IPCEventField the client wants, all by default
+  int encoding;        // IPCEncoding of events, compact by default
+  int reply_encoding;  // IPCEncoding of replies, pretty by default
+  uint32_t caps;  // IPCCapability granted by IPC_TYPE_HELLO
+  int dropping;   // Disconnected by the queue policy, see ipc_drop_pending
 
-  char *buffer;
-  uint32_t buffer_size;
+  // Partially received message, kept across epoll wakeups
+  IPCRecvState recv_state;
+  uint8_t recv_header[IPC_HEADER_SIZE];
+  uint8_t recv_type;
+  uint32_t recv_size;
+  uint32_t recv_len;  // Bytes of the current header or payload received
+  char *recv_buf;
+
+  // Ring buffer of messages waiting to be written to the client
+  IPCQueueEntry *queue;
+  unsigned int queue_head;
+  unsigned int queue_len;
+  unsigned int queue_cap;
+  uint32_t queue_bytes;  // Bytes of the queue not written yet
+
+  // Counters reported by IPC_TYPE_GET_IPC_CLIENTS
+  unsigned long bytes_queued;    // Total bytes ever queued
+  unsigned long events_dropped;  // Events dropped or coalesced by the policy
 
   struct epoll_event event;
   IPCClient *next;
@@ -58,4 +114,55 @@ void ipc_list_remove_client(IPCClientList *list, IPCClient *c);
  */
 IPCClient *ipc_list_get_client(IPCClientList list, int fd);
 
+/**
+ * Drop a reference to a message, freeing it when it was the last one
+ *
+ * @param msg Message to release
+ */
+void ipc_message_unref(IPCMessage *msg);
+
+/**
+ * Append a message to the output queue of a client. The queue takes its own
+ * reference to the message.
+ *
+ * @param c Client to queue the message on
+ * @param msg Message to queue
+ */
+void ipc_client_queue_push(IPCClient *c, IPCMessage *msg);
+
+/**
+ * Get an entry of the client's output queue
+ *
+ * @param c Client whose queue to look at
+ * @param i Position in the queue, 0 is the oldest entry
+ *
+ * @return Address of the entry
+ */
+IPCQueueEntry *ipc_client_queue_at(IPCClient *c, unsigned int i);
+
+/**
+ * Remove an entry from the client's output queue and release its message.
+ * Only entries with nothing written yet may be removed.
+ *
+ * @param c Client whose queue to remove the entry from
+ * @param i Position in the queue, 0 is the oldest entry
+ */
+void ipc_client_queue_remove(IPCClient *c, unsigned int i);
+
+/**
+ * Mark bytes at the front of the client's output queue as written, releasing
+ * every message that was written completely.
+ *
+ * @param c Client whose queue to advance
+ * @param n Number of bytes written, at most the total pending in the queue
+ */
+void ipc_client_queue_consume(IPCClient *c, size_t n);
+
+/**
+ * Release every message queued on the client and free the queue
+ *
+ * @param c Client whose queue to clear
+ */
+void ipc_client_queue_clear(IPCClient *c);
+
 #endif  // IPC_CLIENT_H_
@@ -56,11 +56,11 @@ static const int nrightcols		= 1;	/* number of right columns for n column layout
 #include "varcol.c"
 
 static const Layout layouts[] = {
-	/* symbol     arrange function */
-	{ "=O=",      varcol },  /* first entry is default */
-	{ "[]=",      tile },    /* first entry is default */
-	{ "><>",      NULL },    /* no layout function means floating behavior */
-	{ "[M]",      monocle },
+	/* symbol     arrange function  compute function */
+	{ "=O=",      varcol,           varcolrects },  /* first entry is default */
+	{ "[]=",      tile,             tilerects },    /* first entry is default */
+	{ "><>",      NULL,             NULL },         /* no layout function means floating behavior */
+	{ "[M]",      monocle,          monoclerects },
 };
 #include "nextlayout.c"
 
@@ -150,6 +150,9 @@ static Button buttons[] = {
 };
 
 static const char *ipcsockpath = "/tmp/dwm.sock";
+static const unsigned int ipcqueuemax = 256 * 1024; /* bytes of events queued for an IPC client that isn't reading */
+static const int ipcqueuepolicy = IPC_QUEUE_COALESCE; /* or IPC_QUEUE_DROP_OLDEST, IPC_QUEUE_DISCONNECT */
+static const char *ipcstatename = "/dwm-state"; /* shared memory state snapshot for bars, NULL to disable */
 static IPCCommand ipccommands[] = {
   IPCCOMMAND(  view,                1,      {ARG_TYPE_UINT}   ),
   IPCCOMMAND(  toggleview,          1,      {ARG_TYPE_UINT}   ),
@@ -14,6 +14,14 @@ X11LIB = /usr/X11R6/lib
 XINERAMALIBS  = -lXinerama
 XINERAMAFLAGS = -DXINERAMA
 
+# Cross-check the window indexes against the client lists, uncomment
+# to debug
+#WINHASHFLAGS = -DWINHASH_DEBUG
+
+# Keep the swallow pid cache current through the Linux proc connector, needs
+# CAP_NET_ADMIN, uncomment to enable
+#PROCCONNFLAGS = -DPROCCONN
+
 # freetype
 FREETYPELIBS = -lfontconfig -lXft
 FREETYPEINC = /usr/include/freetype2
@@ -25,12 +33,15 @@ FREETYPEINC = /usr/include/freetype2
 YAJLLIBS = -lyajl
 YAJLINC = /usr/include/yajl
 
+# shm_open() for the IPC state snapshot, part of libc since glibc 2.34
+RTLIBS = -lrt
+
 # includes and libs
 INCS = -I${X11INC} -I${FREETYPEINC} -I${YAJLINC}
-LIBS = -L${X11LIB} -lX11 ${XINERAMALIBS} ${FREETYPELIBS} -lX11-xcb -lxcb -lxcb-res ${KVMLIB} -lXrender  ${YAJLLIBS}
+LIBS = -L${X11LIB} -lX11 ${XINERAMALIBS} ${FREETYPELIBS} -lX11-xcb -lxcb -lxcb-res ${KVMLIB} -lXrender  ${YAJLLIBS} ${RTLIBS}
 
 # flags
-CPPFLAGS = -D_DEFAULT_SOURCE -D_BSD_SOURCE -D_POSIX_C_SOURCE=200809L -DVERSION=\"${VERSION}\" ${XINERAMAFLAGS}
+CPPFLAGS = -D_DEFAULT_SOURCE -D_BSD_SOURCE -D_POSIX_C_SOURCE=200809L -DVERSION=\"${VERSION}\" ${XINERAMAFLAGS} ${WINHASHFLAGS} ${PROCCONNFLAGS}
 CFLAGS   = -g -std=c99 -pedantic -Wall -Wno-deprecated-declarations -O0 ${INCS} ${CPPFLAGS}
 # CFLAGS   = -std=c99 -pedantic -Wall -Wno-deprecated-declarations -Os ${INCS} ${CPPFLAGS}
 LDFLAGS  = ${LIBS}
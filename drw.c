@@ -10,6 +10,8 @@
 
 #define UTF_INVALID 0xFFFD
 #define UTF_SIZ     4
+#define LENGTH(X)   (sizeof(X) / sizeof((X)[0]))
+#define UTF8CONT(c) (((unsigned char)(c) & 0xC0) == 0x80)
 
 static const unsigned char utfbyte[UTF_SIZ + 1] = {0x80,    0, 0xC0, 0xE0, 0xF0};
 static const unsigned char utfmask[UTF_SIZ + 1] = {0xC0, 0x80, 0xE0, 0xF0, 0xF8};
@@ -60,6 +62,108 @@ utf8decode(const char *c, long *u, size_t clen)
 	return len;
 }
 
+/* Returns the length of the longest prefix of the first len bytes of text
+ * that fits in w pixels, cut on a codepoint boundary, and stores its width
+ * in ew. Binary search keeps this at O(log len) extent queries. */
+static size_t
+utf8fit(Fnt *font, const char *text, size_t len, unsigned int w, unsigned int *ew)
+{
+	size_t lo = 0, hi = len, mid;
+	unsigned int mw;
+
+	*ew = 0;
+	while (lo < hi) {
+		mid = lo + (hi - lo + 1) / 2;
+		while (mid > lo && UTF8CONT(text[mid]))
+			mid--;
+		if (mid == lo) {
+			/* no boundary in the lower half, try the first one above lo */
+			for (mid = lo + 1; mid < hi && UTF8CONT(text[mid]); mid++)
+				;
+			if (UTF8CONT(text[mid]))
+				break;
+		}
+		drw_font_getexts(font, text, mid, &mw, NULL);
+		if (mw <= w) {
+			lo = mid;
+			*ew = mw;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	return lo;
+}
+
+/* The font to draw a codepoint with only depends on the fontset, so it is
+ * looked up once and cached in a page table for the BMP and a small hash
+ * table for the rest. Codepoints no font has map to the first font, which
+ * draws the missing-character box, so fontconfig is asked only once. Text
+ * widths are cached as well and depend on the fontset just the same. */
+static void
+fontmap_clear(Drw *drw)
+{
+	size_t i;
+
+	memset(drw->widths, 0, sizeof(drw->widths));
+	drw->widthstamp = 0;
+
+	for (i = 0; i < LENGTH(drw->fontpages); i++) {
+		free(drw->fontpages[i]);
+		drw->fontpages[i] = NULL;
+	}
+	free(drw->fontmap);
+	drw->fontmap = NULL;
+	drw->fontmaplen = drw->fontmapcap = 0;
+}
+
+static FntMapEntry *
+fontmap_find(FntMapEntry *map, size_t cap, long codepoint)
+{
+	size_t i;
+
+	for (i = (codepoint * 2654435761UL) & (cap - 1); map[i].codepoint && map[i].codepoint != codepoint; i = (i + 1) & (cap - 1))
+		;
+	return &map[i];
+}
+
+/* Returns the cache slot of codepoint, NULL if it can't be allocated. The
+ * slot holds NULL until the codepoint has been looked up. */
+static Fnt **
+fontmap_slot(Drw *drw, long codepoint)
+{
+	FntMapEntry *e, *old;
+	size_t i, oldcap;
+
+	if (codepoint < 0x10000) {
+		if (!drw->fontpages[codepoint >> 8] &&
+		    !(drw->fontpages[codepoint >> 8] = calloc(256, sizeof(Fnt *))))
+			return NULL;
+		return &drw->fontpages[codepoint >> 8][codepoint & 0xff];
+	}
+
+	/* keep the load factor at or below one half */
+	if (2 * (drw->fontmaplen + 1) > drw->fontmapcap) {
+		old = drw->fontmap;
+		oldcap = drw->fontmapcap;
+		if (!(drw->fontmap = calloc(oldcap ? oldcap * 2 : 64, sizeof(FntMapEntry)))) {
+			drw->fontmap = old;
+			return NULL;
+		}
+		drw->fontmapcap = oldcap ? oldcap * 2 : 64;
+		for (i = 0; i < oldcap; i++)
+			if (old[i].codepoint)
+				*fontmap_find(drw->fontmap, drw->fontmapcap, old[i].codepoint) = old[i];
+		free(old);
+	}
+
+	e = fontmap_find(drw->fontmap, drw->fontmapcap, codepoint);
+	if (!e->codepoint) {
+		e->codepoint = codepoint;
+		drw->fontmaplen++;
+	}
+	return &e->font;
+}
+
 Drw *
 drw_create(Display *dpy, int screen, Window root, unsigned int w, unsigned int h, Visual *visual, unsigned int depth, Colormap cmap)
 {
@@ -74,6 +178,7 @@ drw_create(Display *dpy, int screen, Window root, unsigned int w, unsigned int h
 	drw->depth = depth;
 	drw->cmap = cmap;
 	drw->drawable = XCreatePixmap(dpy, root, w, h, depth);
+	drw->xftdraw = XftDrawCreate(dpy, drw->drawable, visual, cmap);
 	drw->gc = XCreateGC(dpy, drw->drawable, 0, NULL);
 	XSetLineAttributes(dpy, drw->gc, 1, LineSolid, CapButt, JoinMiter);
 
@@ -91,13 +196,17 @@ drw_resize(Drw *drw, unsigned int w, unsigned int h)
 	if (drw->drawable)
 		XFreePixmap(drw->dpy, drw->drawable);
 	drw->drawable = XCreatePixmap(drw->dpy, drw->root, w, h, drw->depth);
+	XftDrawChange(drw->xftdraw, drw->drawable);
+	drw->ndamage = 0;
 }
 
 void
 drw_free(Drw *drw)
 {
+	XftDrawDestroy(drw->xftdraw);
 	XFreePixmap(drw->dpy, drw->drawable);
 	XFreeGC(drw->dpy, drw->gc);
+	fontmap_clear(drw);
 	drw_fontset_free(drw->fonts);
 	free(drw);
 }
@@ -161,14 +270,112 @@ xfont_create(Drw *drw, const char *fontname, FcPattern *fontpattern)
 static void
 xfont_free(Fnt *font)
 {
+	size_t i, j;
+
 	if (!font)
 		return;
+	for (i = 0; i < LENGTH(font->advances); i++) {
+		if (!font->advances[i])
+			continue;
+		for (j = 0; j < 256; j++)
+			free(font->advances[i][j]);
+		free(font->advances[i]);
+	}
 	if (font->pattern)
 		FcPatternDestroy(font->pattern);
 	XftFontClose(font->dpy, font->xfont);
 	free(font);
 }
 
+/* Returns the advance of the glyph of codepoint in font. Advances are cached
+ * per font in lazily allocated pages, so measuring text only asks Xft about
+ * each glyph once. */
+static unsigned int
+xfont_advance(Fnt *font, long codepoint)
+{
+	unsigned short **plane, *page = NULL;
+	FT_UInt glyph;
+	XGlyphInfo ext;
+	unsigned int adv;
+
+	if ((plane = font->advances[codepoint >> 16]) ||
+	    (plane = font->advances[codepoint >> 16] = calloc(256, sizeof(*plane)))) {
+		if (!(page = plane[(codepoint >> 8) & 0xff]))
+			page = plane[(codepoint >> 8) & 0xff] = calloc(256, sizeof(*page));
+		if (page && page[codepoint & 0xff])
+			return page[codepoint & 0xff] - 1;
+	}
+
+	glyph = XftCharIndex(font->dpy, font->xfont, codepoint);
+	XftGlyphExtents(font->dpy, font->xfont, &glyph, 1, &ext);
+	/* xOff is a short, a negative advance would wrap around in the sum */
+	adv = ext.xOff > 0 ? ext.xOff : 0;
+	if (page)
+		page[codepoint & 0xff] = adv + 1;
+	return adv;
+}
+
+/* Returns the font of the fontset that has codepoint, loading a fallback
+ * font through fontconfig if none has. */
+static Fnt *
+xfont_lookup(Drw *drw, long codepoint)
+{
+	Fnt *font, *curfont, **slot;
+	FcCharSet *fccharset;
+	FcPattern *fcpattern;
+	FcPattern *match;
+	XftResult result;
+
+	if ((slot = fontmap_slot(drw, codepoint)) && *slot)
+		return *slot;
+
+	for (font = drw->fonts; font; font = font->next)
+		if (XftCharExists(drw->dpy, font->xfont, codepoint))
+			break;
+
+	if (!font) {
+		fccharset = FcCharSetCreate();
+		FcCharSetAddChar(fccharset, codepoint);
+
+		if (!drw->fonts->pattern) {
+			/* Refer to the comment in xfont_create for more information. */
+			die("the first font in the cache must be loaded from a font string.");
+		}
+
+		fcpattern = FcPatternDuplicate(drw->fonts->pattern);
+		FcPatternAddCharSet(fcpattern, FC_CHARSET, fccharset);
+		FcPatternAddBool(fcpattern, FC_SCALABLE, FcTrue);
+		FcPatternAddBool(fcpattern, FC_COLOR, FcFalse);
+
+		FcConfigSubstitute(NULL, fcpattern, FcMatchPattern);
+		FcDefaultSubstitute(fcpattern);
+		match = XftFontMatch(drw->dpy, drw->screen, fcpattern, &result);
+
+		FcCharSetDestroy(fccharset);
+		FcPatternDestroy(fcpattern);
+
+		if (match) {
+			font = xfont_create(drw, NULL, match);
+			if (font && XftCharExists(drw->dpy, font->xfont, codepoint)) {
+				for (curfont = drw->fonts; curfont->next; curfont = curfont->next)
+					; /* NOP */
+				curfont->next = font;
+			} else {
+				xfont_free(font);
+				font = NULL;
+			}
+		}
+	}
+
+	/* Regardless of whether or not a fallback font is found, the
+	 * character must be drawn. */
+	if (!font)
+		font = drw->fonts;
+	if (slot)
+		*slot = font;
+	return font;
+}
+
 Fnt*
 drw_fontset_create(Drw* drw, const char *fonts[], size_t fontcount)
 {
@@ -184,6 +391,7 @@ drw_fontset_create(Drw* drw, const char *fonts[], size_t fontcount)
 			ret = cur;
 		}
 	}
+	fontmap_clear(drw);
 	return (drw->fonts = ret);
 }
 
@@ -280,8 +488,10 @@ drw_scm_create(Drw *drw, const char *clrnames[], size_t clrcount)
 void
 drw_setfontset(Drw *drw, Fnt *set)
 {
-	if (drw)
+	if (drw && drw->fonts != set) {
+		fontmap_clear(drw);
 		drw->fonts = set;
+	}
 }
 
 void
@@ -297,6 +507,7 @@ drw_rect(Drw *drw, int x, int y, unsigned int w, unsigned int h, int filled, int
 	if (!drw || !drw->scheme)
 		return;
 	XSetForeground(drw->dpy, drw->gc, invert ? drw->scheme[ColBg].pixel : drw->scheme[ColFg].pixel);
+	drw_damage(drw, x, y, w, h);
 	if (filled)
 		XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h);
 	else
@@ -309,17 +520,12 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 	char buf[1024];
 	int ty;
 	unsigned int ew;
-	XftDraw *d = NULL;
+	size_t ellipsis;
 	Fnt *usedfont, *curfont, *nextfont;
 	size_t i, len;
 	int utf8strlen, utf8charlen, render = x || y || w || h;
 	long utf8codepoint = 0;
 	const char *utf8str;
-	FcCharSet *fccharset;
-	FcPattern *fcpattern;
-	FcPattern *match;
-	XftResult result;
-	int charexists = 0;
 
 	if (!drw || (render && !drw->scheme) || !text || !drw->fonts)
 		return 0;
@@ -329,7 +535,7 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 	} else {
 		XSetForeground(drw->dpy, drw->gc, drw->scheme[invert ? ColFg : ColBg].pixel);
 		XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h);
-		d = XftDrawCreate(drw->dpy, drw->drawable, drw->visual, drw->cmap);
+		drw_damage(drw, x, y, w, h);
 		x += lpad;
 		w -= lpad;
 	}
@@ -341,41 +547,39 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 		nextfont = NULL;
 		while (*text) {
 			utf8charlen = utf8decode(text, &utf8codepoint, UTF_SIZ);
-			for (curfont = drw->fonts; curfont; curfont = curfont->next) {
-				charexists = charexists || XftCharExists(drw->dpy, curfont->xfont, utf8codepoint);
-				if (charexists) {
-					if (curfont == usedfont) {
-						utf8strlen += utf8charlen;
-						text += utf8charlen;
-					} else {
-						nextfont = curfont;
-					}
-					break;
-				}
-			}
-
-			if (!charexists || nextfont)
+			curfont = xfont_lookup(drw, utf8codepoint);
+			if (curfont != usedfont) {
+				nextfont = curfont;
 				break;
-			else
-				charexists = 0;
+			}
+			utf8strlen += utf8charlen;
+			text += utf8charlen;
 		}
 
 		if (utf8strlen) {
 			drw_font_getexts(usedfont, utf8str, utf8strlen, &ew, NULL);
 			/* shorten text if necessary */
-			for (len = MIN(utf8strlen, sizeof(buf) - 1); len && ew > w; len--)
-				drw_font_getexts(usedfont, utf8str, len, &ew, NULL);
+			len = utf8strlen;
+			if (ew > w || len > sizeof(buf) - 1)
+				len = utf8fit(usedfont, utf8str, MIN(len, sizeof(buf) - 1), w, &ew);
 
 			if (len) {
 				memcpy(buf, utf8str, len);
+				if (len < utf8strlen) {
+					/* replace the last characters by an ellipsis,
+					 * dropping whole codepoints only */
+					for (i = len; i && len - i < 3; )
+						while (i && UTF8CONT(buf[--i]))
+							; /* NOP */
+					ellipsis = MIN(3, len - i);
+					memset(buf + i, '.', ellipsis);
+					len = i + ellipsis;
+				}
 				buf[len] = '\0';
-				if (len < utf8strlen)
-					for (i = len; i && i > len - 3; buf[--i] = '.')
-						; /* NOP */
 
 				if (render) {
 					ty = y + (h - usedfont->h) / 2 + usedfont->xfont->ascent;
-					XftDrawStringUtf8(d, &drw->scheme[invert ? ColBg : ColFg],
+					XftDrawStringUtf8(drw->xftdraw, &drw->scheme[invert ? ColBg : ColFg],
 					                  usedfont->xfont, x, ty, (XftChar8 *)buf, len);
 				}
 				x += ew;
@@ -383,84 +587,129 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 			}
 		}
 
-		if (!*text) {
+		if (!*text)
 			break;
-		} else if (nextfont) {
-			charexists = 0;
-			usedfont = nextfont;
-		} else {
-			/* Regardless of whether or not a fallback font is found, the
-			 * character must be drawn. */
-			charexists = 1;
+		usedfont = nextfont;
+	}
 
-			fccharset = FcCharSetCreate();
-			FcCharSetAddChar(fccharset, utf8codepoint);
+	return x + (render ? w : 0);
+}
 
-			if (!drw->fonts->pattern) {
-				/* Refer to the comment in xfont_create for more information. */
-				die("the first font in the cache must be loaded from a font string.");
-			}
+/* Record that an area of the drawable changed. Overlapping or touching
+ * areas are merged, and once the list is full a new area is merged into the
+ * last entry, so drw_map issues at most LENGTH(drw->damage) copies. */
+void
+drw_damage(Drw *drw, int x, int y, unsigned int w, unsigned int h)
+{
+	XRectangle *r;
+	int i, x2, y2;
 
-			fcpattern = FcPatternDuplicate(drw->fonts->pattern);
-			FcPatternAddCharSet(fcpattern, FC_CHARSET, fccharset);
-			FcPatternAddBool(fcpattern, FC_SCALABLE, FcTrue);
-			FcPatternAddBool(fcpattern, FC_COLOR, FcFalse);
-
-			FcConfigSubstitute(NULL, fcpattern, FcMatchPattern);
-			FcDefaultSubstitute(fcpattern);
-			match = XftFontMatch(drw->dpy, drw->screen, fcpattern, &result);
-
-			FcCharSetDestroy(fccharset);
-			FcPatternDestroy(fcpattern);
-
-			if (match) {
-				usedfont = xfont_create(drw, NULL, match);
-				if (usedfont && XftCharExists(drw->dpy, usedfont->xfont, utf8codepoint)) {
-					for (curfont = drw->fonts; curfont->next; curfont = curfont->next)
-						; /* NOP */
-					curfont->next = usedfont;
-				} else {
-					xfont_free(usedfont);
-					usedfont = drw->fonts;
-				}
-			}
+	if (!drw)
+		return;
+
+	x2 = MIN((int)drw->w, x + (int)w);
+	y2 = MIN((int)drw->h, y + (int)h);
+	x = MAX(x, 0);
+	y = MAX(y, 0);
+	if (x >= x2 || y >= y2)
+		return;
+
+	for (i = 0; i < drw->ndamage; i++) {
+		r = &drw->damage[i];
+		if (i == LENGTH(drw->damage) - 1 || (x <= r->x + r->width && r->x <= x2 &&
+		    y <= r->y + r->height && r->y <= y2)) {
+			x2 = MAX(x2, r->x + r->width);
+			y2 = MAX(y2, r->y + r->height);
+			x = MIN(x, r->x);
+			y = MIN(y, r->y);
+			/* the grown area may now reach earlier ones, start over */
+			drw->damage[i] = drw->damage[--drw->ndamage];
+			i = -1;
 		}
 	}
-	if (d)
-		XftDrawDestroy(d);
-
-	return x + (render ? w : 0);
+	r = &drw->damage[drw->ndamage++];
+	r->x = x;
+	r->y = y;
+	r->width = x2 - x;
+	r->height = y2 - y;
 }
 
+/* Copy what was drawn since the last call and lies within the area to win.
+ * The damage is reset either way: the next window mapped from the drawable
+ * must only get what is drawn for it. If nothing was drawn since, the call
+ * remaps what is already there, e.g. on Expose, and copies the whole area. */
 void
 drw_map(Drw *drw, Window win, int x, int y, unsigned int w, unsigned int h)
 {
+	XRectangle *r;
+	int i, x1, y1, x2, y2, copied = 0;
+
 	if (!drw)
 		return;
 
-	XCopyArea(drw->dpy, drw->drawable, win, drw->gc, x, y, w, h, x, y);
-	XSync(drw->dpy, False);
+	if (!drw->ndamage)
+		drw_damage(drw, x, y, w, h);
+	for (i = 0; i < drw->ndamage; i++) {
+		r = &drw->damage[i];
+		x1 = MAX(x, r->x);
+		y1 = MAX(y, r->y);
+		x2 = MIN(x + (int)w, r->x + r->width);
+		y2 = MIN(y + (int)h, r->y + r->height);
+		if (x1 < x2 && y1 < y2) {
+			XCopyArea(drw->dpy, drw->drawable, win, drw->gc, x1, y1, x2 - x1, y2 - y1, x1, y1);
+			copied = 1;
+		}
+	}
+	drw->ndamage = 0;
+	if (copied)
+		XSync(drw->dpy, False);
 }
 
 unsigned int
 drw_fontset_getwidth(Drw *drw, const char *text)
 {
+	TextWidth *e, *lru;
+	size_t i, len;
+
 	if (!drw || !drw->fonts || !text)
 		return 0;
-	return drw_text(drw, 0, 0, 0, 0, 0, text, 0);
+	/* only short strings such as tags and layout symbols are remembered */
+	if ((len = strlen(text)) >= sizeof(lru->text))
+		return drw_text(drw, 0, 0, 0, 0, 0, text, 0);
+
+	for (i = 0, lru = drw->widths; i < LENGTH(drw->widths); i++) {
+		e = &drw->widths[i];
+		if (e->stamp && !strcmp(e->text, text)) {
+			e->stamp = ++drw->widthstamp;
+			return e->w;
+		}
+		if (e->stamp < lru->stamp)
+			lru = e;
+	}
+	memcpy(lru->text, text, len + 1);
+	lru->w = drw_text(drw, 0, 0, 0, 0, 0, text, 0);
+	lru->stamp = ++drw->widthstamp;
+	return lru->w;
 }
 
 void
 drw_font_getexts(Fnt *font, const char *text, unsigned int len, unsigned int *w, unsigned int *h)
 {
-	XGlyphInfo ext;
+	long codepoint;
+	size_t n;
+	unsigned int i, ew = 0;
 
 	if (!font || !text)
 		return;
 
-	XftTextExtentsUtf8(font->dpy, font->xfont, (XftChar8 *)text, len, &ext);
+	/* Xft has no kerning, so the extent is the sum of the advances */
+	for (i = 0; i < len; i += n) {
+		if (!(n = utf8decode(text + i, &codepoint, len - i)))
+			break;
+		ew += xfont_advance(font, codepoint);
+	}
 	if (w)
-		*w = ext.xOff;
+		*w = ew;
 	if (h)
 		*h = font->h;
 }
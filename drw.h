@@ -9,9 +9,23 @@ typedef struct Fnt {
 	unsigned int h;
 	XftFont *xfont;
 	FcPattern *pattern;
+	unsigned short **advances[17]; /* glyph advance + 1 per plane, page and codepoint */
 	struct Fnt *next;
 } Fnt;
 
+/* codepoint -> font cache entry for codepoints outside the BMP */
+typedef struct {
+	long codepoint;
+	Fnt *font;
+} FntMapEntry;
+
+/* drw_fontset_getwidth result, stamp 0 marks an unused entry */
+typedef struct {
+	unsigned long stamp;
+	unsigned int w;
+	char text[32];
+} TextWidth;
+
 enum { ColFg, ColBg, ColBorder }; /* Clr scheme index */
 typedef XftColor Clr;
 
@@ -24,9 +38,17 @@ typedef struct {
 	unsigned int depth;
 	Colormap cmap;
 	Drawable drawable;
+	XftDraw *xftdraw; /* bound to drawable for the lifetime of the Drw */
 	GC gc;
 	Clr *scheme;
 	Fnt *fonts;
+	Fnt **fontpages[256]; /* BMP codepoint -> font, one page per high byte */
+	FntMapEntry *fontmap; /* open addressed, for the astral planes */
+	size_t fontmaplen, fontmapcap;
+	TextWidth widths[64]; /* least recently used entry is replaced */
+	unsigned long widthstamp;
+	XRectangle damage[8]; /* drawn since the last drw_map */
+	int ndamage;
 } Drw;
 
 /* Drawable abstraction */
@@ -58,4 +80,5 @@ int drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned in
 void drw_arrow(Drw *drw, int x, int y, unsigned int w, unsigned int h, int backwards);
 
 /* Map functions */
+void drw_damage(Drw *drw, int x, int y, unsigned int w, unsigned int h);
 void drw_map(Drw *drw, Window win, int x, int y, unsigned int w, unsigned int h);
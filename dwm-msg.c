@@ -1,13 +1,18 @@
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <poll.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 #include <yajl/yajl_gen.h>
 
@@ -23,6 +28,7 @@
 #define IPC_EVENT_MONITOR_FOCUS_CHANGE "monitor_focus_change_event"
 #define IPC_EVENT_FOCUSED_TITLE_CHANGE "focused_title_change_event"
 #define IPC_EVENT_FOCUSED_STATE_CHANGE "focused_state_change_event"
+#define IPC_EVENT_STATE_CHANGE "state_change_event"
 
 #define YSTR(str) yajl_gen_string(gen, (unsigned char *)str, strlen(str))
 #define YINT(num) yajl_gen_integer(gen, num)
@@ -42,9 +48,18 @@
     yajl_gen_map_close(gen);                                                   \
   }
 
+// Most words of a single run_batch command, the name included
+#define MAX_BATCH_WORDS 64
+// Most requests sent ahead of their replies in --stdin mode
+#define STDIN_MAX_IN_FLIGHT 64
+
+// Attempts at a consistent state snapshot, 1ms apart, before giving up
+#define STATE_READ_TRIES 1000
+
 typedef unsigned long Window;
 
 const char *DEFAULT_SOCKET_PATH = "/tmp/dwm.sock";
+const char *DEFAULT_STATE_NAME = "/dwm-state";
 static int sock_fd = -1;
 static unsigned int ignore_reply = 0;
 
@@ -55,7 +70,14 @@ typedef enum IPCMessageType {
   IPC_TYPE_GET_LAYOUTS = 3,
   IPC_TYPE_GET_DWM_CLIENT = 4,
   IPC_TYPE_SUBSCRIBE = 5,
-  IPC_TYPE_EVENT = 6
+  IPC_TYPE_EVENT = 6,
+  IPC_TYPE_GET_STATS = 7,
+  IPC_TYPE_SET_ENCODING = 8,
+  IPC_TYPE_GET_IPC_CLIENTS = 9,
+  IPC_TYPE_HELLO = 10,
+  IPC_TYPE_RUN_COMMAND_BIN = 11,
+  IPC_TYPE_EVENT_BIN = 12,
+  IPC_TYPE_RUN_BATCH = 13
 } IPCMessageType;
 
 // Every IPC message must begin with this
@@ -65,6 +87,86 @@ typedef struct dwm_ipc_header {
   uint8_t type;
 } __attribute((packed)) dwm_ipc_header_t;
 
+// Binary protocol, see ipc.h
+#define IPC_BIN_VERSION 1
+#define IPC_BIN_MAX_ARGS 8
+#define IPC_CAP_BINARY_COMMANDS (1 << 0)
+
+typedef enum ArgType {
+  ARG_TYPE_UINT = 1,
+  ARG_TYPE_SINT = 2,
+  ARG_TYPE_FLOAT = 3
+} ArgType;
+
+typedef struct IPCBinHello {
+  uint16_t version;
+  uint16_t ncommands;
+  uint32_t caps;
+} __attribute((packed)) IPCBinHello;
+
+typedef struct IPCBinCommand {
+  uint16_t command;
+  uint8_t argc;
+  uint8_t reserved;
+} __attribute((packed)) IPCBinCommand;
+
+typedef struct IPCBinArg {
+  uint8_t type;
+  uint8_t reserved[7];
+  union {
+    uint64_t ui;
+    int64_t i;
+    float f;
+  } value;
+} __attribute((packed)) IPCBinArg;
+
+typedef struct IPCBinResult {
+  uint32_t status;
+} __attribute((packed)) IPCBinResult;
+
+// Shared memory state snapshot, see ipc.h
+#define IPC_STATE_MAGIC 0x534d5744
+#define IPC_STATE_VERSION 1
+#define IPC_STATE_FLOATING (1 << 2)
+#define IPC_STATE_FULLSCREEN (1 << 3)
+#define IPC_STATE_URGENT (1 << 4)
+
+typedef struct IPCStateHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t seq;
+  uint32_t size;
+  uint32_t length;
+  uint32_t nmons;
+  uint32_t nclients;
+  int32_t selmon;
+} IPCStateHeader;
+
+typedef struct IPCStateMonitor {
+  int32_t num;
+  int32_t mx, my, mw, mh;
+  int32_t wx, wy, ww, wh;
+  uint32_t tagset;
+  uint32_t occupied;
+  uint32_t urgent;
+  int32_t nmaster;
+  float mfact;
+  uint32_t first_client;
+  uint32_t nclients;
+  uint64_t sel;
+  char ltsymbol[16];
+} __attribute((packed)) IPCStateMonitor;
+
+typedef struct IPCStateClient {
+  uint64_t win;
+  int32_t mon;
+  uint32_t tags;
+  int32_t x, y, w, h;
+  int32_t bw;
+  uint8_t state;
+  char name[256];
+} __attribute((packed)) IPCStateClient;
+
 static int
 recv_message(uint8_t *msg_type, uint32_t *reply_size, uint8_t **reply)
 {
@@ -305,15 +407,14 @@ print_socket_reply()
   free(reply);
 }
 
-static int
-run_command(const char *name, char *args[], int argc)
+/**
+ * Generate a command object, typing each argument as a signed int, float or
+ * string
+ */
+static void
+gen_command(yajl_gen gen, const char *name, char *args[], int argc)
 {
-  const unsigned char *msg;
-  size_t msg_size;
-
-  yajl_gen gen = yajl_gen_alloc(NULL);
-
-  // Message format:
+  // Format:
   // {
   //   "command": "<name>",
   //   "args": [ ... ]
@@ -336,11 +437,72 @@ run_command(const char *name, char *args[], int argc)
     )
   )
   // clang-format on
+}
 
+static void
+send_run_command(const char *name, char *args[], int argc)
+{
+  const unsigned char *msg;
+  size_t msg_size;
+
+  yajl_gen gen = yajl_gen_alloc(NULL);
+
+  gen_command(gen, name, args, argc);
   yajl_gen_get_buf(gen, &msg, &msg_size);
 
   send_message(IPC_TYPE_RUN_COMMAND, msg_size, (uint8_t *)msg);
 
+  yajl_gen_free(gen);
+}
+
+static int
+run_command(const char *name, char *args[], int argc)
+{
+  send_run_command(name, args, argc);
+
+  if (!ignore_reply)
+    print_socket_reply();
+  else
+    flush_socket_reply();
+
+  return 0;
+}
+
+/**
+ * Run several commands as one batch. Every command is a single string of the
+ * command name followed by its arguments, separated by spaces.
+ */
+static int
+run_batch(char *commands[], int count)
+{
+  const unsigned char *msg;
+  size_t msg_size;
+  char *words[MAX_BATCH_WORDS];
+
+  yajl_gen gen = yajl_gen_alloc(NULL);
+
+  // Message format:
+  // {
+  //   "commands": [ { "command": "<name>", "args": [ ... ] }, ... ]
+  // }
+  // clang-format off
+  YMAP(
+    YSTR("commands"); YARR(
+      for (int i = 0; i < count; i++) {
+        int n = 0;
+        for (char *w = strtok(commands[i], " \t"); w && n < MAX_BATCH_WORDS;
+             w = strtok(NULL, " \t"))
+          words[n++] = w;
+        if (n > 0) gen_command(gen, words[0], words + 1, n - 1);
+      }
+    )
+  )
+  // clang-format on
+
+  yajl_gen_get_buf(gen, &msg, &msg_size);
+
+  send_message(IPC_TYPE_RUN_BATCH, msg_size, (uint8_t *)msg);
+
   if (!ignore_reply)
     print_socket_reply();
   else
@@ -351,6 +513,157 @@ run_command(const char *name, char *args[], int argc)
   return 0;
 }
 
+/**
+ * Negotiate binary commands and look up the index of the named command
+ *
+ * Returns the command index
+ * Returns -1 if dwm didn't grant binary commands or has no such command
+ */
+static int
+hello(const char *name)
+{
+  IPCBinHello hello = {.version = IPC_BIN_VERSION,
+                       .caps = IPC_CAP_BINARY_COMMANDS};
+  IPCMessageType reply_type;
+  uint32_t reply_size;
+  char *reply;
+  int index = -1;
+
+  send_message(IPC_TYPE_HELLO, sizeof(hello), (uint8_t *)&hello);
+  read_socket(&reply_type, &reply_size, &reply);
+
+  if (reply_type == IPC_TYPE_HELLO && reply_size >= sizeof(hello)) {
+    memcpy(&hello, reply, sizeof(hello));
+    if (hello.caps & IPC_CAP_BINARY_COMMANDS) {
+      // Command names follow the header, null terminated
+      char *walk = reply + sizeof(hello);
+      for (int i = 0; i < hello.ncommands && walk < reply + reply_size; i++) {
+        if (strcmp(walk, name) == 0) index = i;
+        walk += strlen(walk) + 1;
+      }
+    }
+  }
+
+  free(reply);
+  return index;
+}
+
+/**
+ * Send an IPC_TYPE_RUN_COMMAND_BIN message, typing arguments like
+ * send_run_command() does
+ *
+ * Returns 0 if the message was sent
+ * Returns -1 if an argument can't be sent in binary
+ */
+static int
+send_run_command_bin(int index, char *args[], int argc)
+{
+  IPCBinCommand cmd = {.command = index, .argc = argc};
+  uint8_t buf[sizeof(cmd) + IPC_BIN_MAX_ARGS * sizeof(IPCBinArg)];
+  IPCBinArg arg;
+
+  if (argc > IPC_BIN_MAX_ARGS) return -1;
+
+  memcpy(buf, &cmd, sizeof(cmd));
+  for (int i = 0; i < argc; i++) {
+    memset(&arg, 0, sizeof(arg));
+    if (is_signed_int(args[i])) {
+      arg.value.i = atoll(args[i]);
+      arg.type = arg.value.i < 0 ? ARG_TYPE_SINT : ARG_TYPE_UINT;
+    } else if (is_float(args[i])) {
+      arg.value.f = atof(args[i]);
+      arg.type = ARG_TYPE_FLOAT;
+    } else
+      return -1;
+    memcpy(buf + sizeof(cmd) + i * sizeof(arg), &arg, sizeof(arg));
+  }
+
+  send_message(IPC_TYPE_RUN_COMMAND_BIN, sizeof(cmd) + argc * sizeof(arg),
+               buf);
+  return 0;
+}
+
+static double
+elapsed_us(const struct timespec *start)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1e6 +
+         (now.tv_nsec - start->tv_nsec) / 1e3;
+}
+
+static void
+print_bench(const char *protocol, long count, double total, double min,
+            double max)
+{
+  printf("%-7s %ld round trips, mean %.1f us, min %.1f us, max %.1f us\n",
+         protocol, count, total / count, min, max);
+}
+
+/**
+ * Run a command count times as JSON and then as binary messages, waiting for
+ * each reply, and print the round trip latencies of both
+ */
+static int
+bench(long count, const char *name, char *args[], int argc)
+{
+  IPCMessageType reply_type;
+  uint32_t reply_size;
+  char *reply;
+  struct timespec start;
+  double t, total, min, max;
+
+  total = max = 0;
+  min = 1e12;
+  for (long i = 0; i < count; i++) {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    send_run_command(name, args, argc);
+    read_socket(&reply_type, &reply_size, &reply);
+    t = elapsed_us(&start);
+    free(reply);
+
+    total += t;
+    min = t < min ? t : min;
+    max = t > max ? t : max;
+  }
+  print_bench("json", count, total, min, max);
+
+  const int index = hello(name);
+  if (index < 0) {
+    fprintf(stderr, "dwm has no binary command '%s'\n", name);
+    return 1;
+  }
+
+  total = max = 0;
+  min = 1e12;
+  for (long i = 0; i < count; i++) {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (send_run_command_bin(index, args, argc) < 0) {
+      fputs("Only numeric arguments can be sent in binary\n", stderr);
+      return 1;
+    }
+    read_socket(&reply_type, &reply_size, &reply);
+    t = elapsed_us(&start);
+
+    IPCBinResult result = {.status = 0};
+    if (reply_size >= sizeof(result)) memcpy(&result, reply, sizeof(result));
+    free(reply);
+    if (result.status != 0) {
+      fprintf(stderr, "Binary command failed with status %u\n",
+              result.status);
+      return 1;
+    }
+
+    total += t;
+    min = t < min ? t : min;
+    max = t > max ? t : max;
+  }
+  print_bench("binary", count, total, min, max);
+
+  return 0;
+}
+
 static int
 get_monitors()
 {
@@ -359,6 +672,40 @@ get_monitors()
   return 0;
 }
 
+static void
+send_get_monitors_since(unsigned long since)
+{
+  const unsigned char *msg;
+  size_t msg_size;
+
+  yajl_gen gen = yajl_gen_alloc(NULL);
+
+  // Message format:
+  // {
+  //   "since": <generation>
+  // }
+  // clang-format off
+  YMAP(
+    YSTR("since"); YINT(since);
+  )
+  // clang-format on
+
+  yajl_gen_get_buf(gen, &msg, &msg_size);
+
+  send_message(IPC_TYPE_GET_MONITORS, msg_size, (uint8_t *)msg);
+
+  yajl_gen_free(gen);
+}
+
+static int
+get_monitors_since(unsigned long since)
+{
+  send_get_monitors_since(since);
+  print_socket_reply();
+
+  return 0;
+}
+
 static int
 get_tags()
 {
@@ -378,7 +725,25 @@ get_layouts()
 }
 
 static int
-get_dwm_client(Window win)
+get_stats()
+{
+  send_message(IPC_TYPE_GET_STATS, 1, (uint8_t *)"");
+  print_socket_reply();
+
+  return 0;
+}
+
+static int
+get_ipc_clients()
+{
+  send_message(IPC_TYPE_GET_IPC_CLIENTS, 1, (uint8_t *)"");
+  print_socket_reply();
+
+  return 0;
+}
+
+static void
+send_get_dwm_client(Window win)
 {
   const unsigned char *msg;
   size_t msg_size;
@@ -399,30 +764,92 @@ get_dwm_client(Window win)
 
   send_message(IPC_TYPE_GET_DWM_CLIENT, msg_size, (uint8_t *)msg);
 
+  yajl_gen_free(gen);
+}
+
+static int
+get_dwm_client(Window win)
+{
+  send_get_dwm_client(win);
   print_socket_reply();
 
+  return 0;
+}
+
+static int
+set_encoding(const char *encoding)
+{
+  const unsigned char *msg;
+  size_t msg_size;
+
+  yajl_gen gen = yajl_gen_alloc(NULL);
+
+  // Message format:
+  // {
+  //   "encoding": "<compact|pretty>"
+  // }
+  // clang-format off
+  YMAP(
+    YSTR("encoding"); YSTR(encoding);
+  )
+  // clang-format on
+
+  yajl_gen_get_buf(gen, &msg, &msg_size);
+
+  send_message(IPC_TYPE_SET_ENCODING, msg_size, (uint8_t *)msg);
+
+  flush_socket_reply();
+
   yajl_gen_free(gen);
 
   return 0;
 }
 
+/**
+ * Subscribe to an event given as "<event>[:<field>,<field>...]". Only changes
+ * to the listed fields are reported. If has_monitor is set, only events of
+ * that monitor are reported, -1 meaning all monitors.
+ */
 static int
-subscribe(const char *event)
+subscribe(const char *spec, int has_monitor, int monitor)
 {
   const unsigned char *msg;
   size_t msg_size;
+  char event[64];
+  const char *fields = strchr(spec, ':');
+  size_t event_len = fields ? (size_t)(fields - spec) : strlen(spec);
+
+  if (event_len >= sizeof(event)) event_len = sizeof(event) - 1;
+  memcpy(event, spec, event_len);
+  event[event_len] = '\0';
 
   yajl_gen gen = yajl_gen_alloc(NULL);
 
   // Message format:
   // {
   //   "event": "<event>",
-  //   "action": "subscribe"
+  //   "action": "subscribe",
+  //   "monitor": <monitor>,          (optional)
+  //   "fields": ["<field>", ...]     (optional)
   // }
   // clang-format off
   YMAP(
     YSTR("event"); YSTR(event);
     YSTR("action"); YSTR("subscribe");
+    if (has_monitor) {
+      YSTR("monitor"); YINT(monitor);
+    }
+    if (fields) {
+      YSTR("fields");
+      YARR(
+        for (const char *f = fields + 1; *f;) {
+          size_t len = strcspn(f, ",");
+          yajl_gen_string(gen, (const unsigned char *)f, len);
+          f += len;
+          if (*f == ',') f++;
+        }
+      )
+    }
   )
   // clang-format on
 
@@ -440,6 +867,358 @@ subscribe(const char *event)
   return 0;
 }
 
+/**
+ * Copy a consistent snapshot out of the shared state region, mapping it again
+ * if it grew. A snapshot that stays inconsistent, e.g. because dwm died while
+ * publishing it, is retried for about STATE_READ_TRIES milliseconds. The
+ * returned buffer must be freed.
+ *
+ * Returns NULL and prints why if no snapshot could be read
+ */
+static char *
+read_state(int fd)
+{
+  const struct timespec pause = {.tv_sec = 0, .tv_nsec = 1000000};
+  struct stat st;
+  IPCStateHeader *h;
+  char *buf = NULL;
+  size_t mapped;
+  uint32_t seq, length;
+
+  if (fstat(fd, &st) < 0 || st.st_size < sizeof(IPCStateHeader)) {
+    fputs("Unsupported state snapshot\n", stderr);
+    return NULL;
+  }
+  mapped = st.st_size;
+  h = mmap(NULL, mapped, PROT_READ, MAP_SHARED, fd, 0);
+  if (h == MAP_FAILED) {
+    perror("mmap");
+    return NULL;
+  }
+
+  if (h->magic != IPC_STATE_MAGIC || h->version != IPC_STATE_VERSION) {
+    fputs("Unsupported state snapshot\n", stderr);
+    munmap(h, mapped);
+    return NULL;
+  }
+
+  for (int tries = 0;; tries++) {
+    if (tries == STATE_READ_TRIES) {
+      fputs("State snapshot stays inconsistent, is dwm still running?\n",
+            stderr);
+      free(buf);
+      buf = NULL;
+      break;
+    }
+    // Spin a little first, dwm only holds the sequence odd for a memcpy
+    if (tries >= 16) nanosleep(&pause, NULL);
+
+    seq = __atomic_load_n(&h->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) continue;
+
+    // Read the size before unmapping, and only map what the file really has
+    const uint32_t size = h->size;
+    if (size > mapped) {
+      if (fstat(fd, &st) < 0 || st.st_size < size) continue;
+      munmap(h, mapped);
+      mapped = size;
+      h = mmap(NULL, mapped, PROT_READ, MAP_SHARED, fd, 0);
+      if (h == MAP_FAILED) {
+        perror("mmap");
+        free(buf);
+        return NULL;
+      }
+      if (h->magic != IPC_STATE_MAGIC || h->version != IPC_STATE_VERSION) {
+        fputs("Unsupported state snapshot\n", stderr);
+        munmap(h, mapped);
+        free(buf);
+        return NULL;
+      }
+      continue;
+    }
+
+    // A torn length is caught by the seq check below
+    length = h->length;
+    if (length < sizeof(IPCStateHeader) || length > mapped) continue;
+    char *p = realloc(buf, length);
+    if (p == NULL) continue;
+    buf = p;
+    memcpy(buf, h, length);
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&h->seq, __ATOMIC_RELAXED) == seq) break;
+  }
+
+  munmap(h, mapped);
+  return buf;
+}
+
+static int
+get_state()
+{
+  int fd = shm_open(DEFAULT_STATE_NAME, O_RDONLY, 0);
+  if (fd < 0) {
+    fprintf(stderr, "Failed to open state '%s', is ipcstatename set?\n",
+            DEFAULT_STATE_NAME);
+    return 1;
+  }
+
+  char *state = read_state(fd);
+  close(fd);
+  if (state == NULL) return 1;
+
+  const IPCStateHeader *h = (IPCStateHeader *)state;
+  const IPCStateMonitor *mons = (IPCStateMonitor *)(h + 1);
+  const IPCStateClient *clients = (IPCStateClient *)(mons + h->nmons);
+  const unsigned char *out;
+  size_t out_size;
+
+  yajl_gen gen = yajl_gen_alloc(NULL);
+  yajl_gen_config(gen, yajl_gen_beautify, 1);
+
+  // clang-format off
+  YMAP(
+    YSTR("sequence"); YINT(h->seq);
+    YSTR("selected_monitor"); YINT(h->selmon);
+    YSTR("monitors"); YARR(
+      for (uint32_t i = 0; i < h->nmons; i++) {
+        const IPCStateMonitor *m = &mons[i];
+        YMAP(
+          YSTR("num"); YINT(m->num);
+          // Don't trust a snapshot to terminate the symbol
+          YSTR("layout_symbol");
+          yajl_gen_string(gen, (unsigned char *)m->ltsymbol,
+                          strnlen(m->ltsymbol, sizeof(m->ltsymbol)));
+          YSTR("tagset"); YINT(m->tagset);
+          YSTR("occupied"); YINT(m->occupied);
+          YSTR("urgent"); YINT(m->urgent);
+          YSTR("selected_client"); YINT(m->sel);
+          YSTR("clients"); YARR(
+            for (uint32_t j = 0; j < m->nclients; j++) {
+              const IPCStateClient *c = &clients[m->first_client + j];
+              YMAP(
+                YSTR("window"); YINT(c->win);
+                YSTR("name"); YSTR(c->name);
+                YSTR("tags"); YINT(c->tags);
+                YSTR("is_floating"); YBOOL(c->state & IPC_STATE_FLOATING);
+                YSTR("is_fullscreen"); YBOOL(c->state & IPC_STATE_FULLSCREEN);
+                YSTR("is_urgent"); YBOOL(c->state & IPC_STATE_URGENT);
+              )
+            }
+          )
+        )
+      }
+    )
+  )
+  // clang-format on
+
+  yajl_gen_get_buf(gen, &out, &out_size);
+  printf("%.*s\n", (int)out_size, out);
+
+  yajl_gen_free(gen);
+  free(state);
+
+  return 0;
+}
+
+/**
+ * Send the request described by a line read in --stdin mode. The words are
+ * those of the matching dwm-msg command, e.g. "run_command view 2".
+ *
+ * Returns 0 if a request was sent
+ * Returns -1 if the line isn't a valid request
+ */
+static int
+send_stdin_request(char *words[], int n)
+{
+  if (strcmp(words[0], "run_command") == 0 && n >= 2)
+    send_run_command(words[1], words + 2, n - 2);
+  else if (strcmp(words[0], "get_monitors") == 0 && n == 1)
+    send_message(IPC_TYPE_GET_MONITORS, 1, (uint8_t *)"");
+  else if (strcmp(words[0], "get_monitors") == 0 && n == 2 &&
+           is_unsigned_int(words[1]))
+    send_get_monitors_since(strtoul(words[1], NULL, 10));
+  else if (strcmp(words[0], "get_tags") == 0 && n == 1)
+    send_message(IPC_TYPE_GET_TAGS, 1, (uint8_t *)"");
+  else if (strcmp(words[0], "get_layouts") == 0 && n == 1)
+    send_message(IPC_TYPE_GET_LAYOUTS, 1, (uint8_t *)"");
+  else if (strcmp(words[0], "get_stats") == 0 && n == 1)
+    send_message(IPC_TYPE_GET_STATS, 1, (uint8_t *)"");
+  else if (strcmp(words[0], "get_ipc_clients") == 0 && n == 1)
+    send_message(IPC_TYPE_GET_IPC_CLIENTS, 1, (uint8_t *)"");
+  else if (strcmp(words[0], "get_dwm_client") == 0 && n == 2 &&
+           is_unsigned_int(words[1]))
+    send_get_dwm_client(strtoul(words[1], NULL, 10));
+  else
+    return -1;
+
+  return 0;
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+  const double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * Print round trip latency percentiles of the requests sent in --stdin mode
+ * to stderr, keeping stdout for the replies
+ */
+static void
+print_latencies(double *samples, size_t count)
+{
+  const double percentiles[] = {50, 90, 99, 99.9};
+
+  if (count == 0) return;
+
+  qsort(samples, count, sizeof(*samples), compare_double);
+
+  fprintf(stderr, "%zu round trips:", count);
+  for (size_t i = 0; i < sizeof(percentiles) / sizeof(*percentiles); i++) {
+    size_t rank = (size_t)(percentiles[i] / 100 * count + 0.5);
+    rank = rank == 0 ? 0 : rank - 1;
+    fprintf(stderr, " p%g %.1f us,", percentiles[i],
+            samples[rank < count ? rank : count - 1]);
+  }
+  fprintf(stderr, " max %.1f us\n", samples[count - 1]);
+}
+
+/**
+ * Read a reply to the oldest request still in flight, print it and record its
+ * round trip latency
+ */
+static void
+read_stdin_reply(struct timespec *sent, size_t *head, double **samples,
+                 size_t *count, size_t *cap)
+{
+  IPCMessageType reply_type;
+  uint32_t reply_size;
+  char *reply;
+
+  read_socket(&reply_type, &reply_size, &reply);
+  const double t = elapsed_us(&sent[*head]);
+  *head = (*head + 1) % STDIN_MAX_IN_FLIGHT;
+
+  if (!ignore_reply) printf("%.*s\n", reply_size, reply);
+  free(reply);
+
+  if (*count == *cap) {
+    size_t new_cap = *cap ? *cap * 2 : 1024;
+    double *new_samples = realloc(*samples, new_cap * sizeof(**samples));
+    if (new_samples == NULL) return;
+    *samples = new_samples;
+    *cap = new_cap;
+  }
+  (*samples)[(*count)++] = t;
+}
+
+/**
+ * Read newline separated requests from stdin and send them all over the one
+ * connection. Up to STDIN_MAX_IN_FLIGHT requests are pipelined; dwm answers
+ * them in order, so replies are matched to requests by position. Empty lines
+ * and lines starting with '#' are skipped.
+ *
+ * Returns 0 if every line was a valid request
+ * Returns 1 otherwise
+ */
+static int
+run_stdin()
+{
+  char buf[4096];
+  size_t len = 0;
+  int eof = 0, ret = 0;
+  unsigned long lineno = 0;
+  struct timespec sent[STDIN_MAX_IN_FLIGHT];
+  size_t head = 0, in_flight = 0;
+  double *samples = NULL;
+  size_t count = 0, cap = 0;
+  char *words[MAX_BATCH_WORDS];
+
+  while (1) {
+    // Send every complete line the window has room for
+    char *line = buf, *nl;
+    while (in_flight < STDIN_MAX_IN_FLIGHT &&
+           (nl = memchr(line, '\n', buf + len - line)) != NULL) {
+      *nl = '\0';
+      lineno++;
+
+      int nwords = 0;
+      for (char *w = strtok(line, " \t"); w && nwords < MAX_BATCH_WORDS;
+           w = strtok(NULL, " \t"))
+        words[nwords++] = w;
+      line = nl + 1;
+
+      if (nwords == 0 || words[0][0] == '#') continue;
+
+      const size_t tail = (head + in_flight) % STDIN_MAX_IN_FLIGHT;
+      clock_gettime(CLOCK_MONOTONIC, &sent[tail]);
+      if (send_stdin_request(words, nwords) < 0) {
+        fprintf(stderr, "Invalid request on line %lu\n", lineno);
+        ret = 1;
+        continue;
+      }
+      in_flight++;
+    }
+    len -= line - buf;
+    memmove(buf, line, len);
+
+    // A complete line is only left over when the window is full
+    const int pending = memchr(buf, '\n', len) != NULL;
+    if (!pending && len == sizeof(buf)) {
+      fprintf(stderr, "Line %lu is too long\n", lineno + 1);
+      len = 0;
+      ret = 1;
+    }
+    if (eof && !pending && in_flight == 0) break;
+
+    const int watch_stdin = !eof && !pending;
+    struct pollfd fds[2] = {{.fd = sock_fd, .events = POLLIN},
+                            {.fd = STDIN_FILENO, .events = POLLIN}};
+
+    if (poll(fds, watch_stdin ? 2 : 1, -1) == -1) {
+      if (errno == EINTR) continue;
+      perror("poll");
+      ret = 1;
+      break;
+    }
+
+    if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+      if (in_flight == 0) {
+        fputs("Connection to dwm closed\n", stderr);
+        ret = 1;
+        break;
+      }
+      read_stdin_reply(sent, &head, &samples, &count, &cap);
+      in_flight--;
+    }
+
+    if (!watch_stdin || !(fds[1].revents & (POLLIN | POLLHUP | POLLERR)))
+      continue;
+
+    const ssize_t n = read(STDIN_FILENO, buf + len, sizeof(buf) - len);
+    if (n == -1) {
+      if (errno == EINTR || errno == EAGAIN) continue;
+      perror("read");
+      ret = 1;
+      eof = 1;
+    } else if (n == 0) {
+      eof = 1;
+    } else
+      len += n;
+
+    // Treat a final line without a newline like any other
+    if (eof && len > 0) buf[len++] = '\n';
+  }
+
+  fflush(stdout);
+  print_latencies(samples, count);
+  free(samples);
+
+  return ret;
+}
+
 static void
 usage_error(const char *prog_name, const char *format, ...)
 {
@@ -463,7 +1242,13 @@ print_usage(const char *name)
   puts("Commands:");
   puts("  run_command <name> [args...]    Run an IPC command");
   puts("");
-  puts("  get_monitors                    Get monitor properties");
+  puts("  run_batch <command>...          Run several IPC commands with a");
+  puts("                                  single arrange, each given as one");
+  puts("                                  quoted '<name> [args...]' string");
+  puts("");
+  puts("  get_monitors [generation]       Get monitor properties, or only the");
+  puts("                                  monitors and clients changed after");
+  puts("                                  the generation of an earlier reply");
   puts("");
   puts("  get_tags                        Get list of tags");
   puts("");
@@ -471,19 +1256,50 @@ print_usage(const char *name)
   puts("");
   puts("  get_dwm_client <window_id>      Get dwm client proprties");
   puts("");
+  puts("  get_stats                       Get internal performance counters");
+  puts("");
+  puts("  get_ipc_clients                 Get output queue counters of IPC");
+  puts("                                  clients");
+  puts("");
+  puts("  get_state                       Read the shared memory state");
+  puts("                                  snapshot without asking dwm");
+  puts("");
   puts("  subscribe [events...]           Subscribe to specified events");
   puts("                                  Options: " IPC_EVENT_TAG_CHANGE ",");
   puts("                                  " IPC_EVENT_LAYOUT_CHANGE ",");
   puts("                                  " IPC_EVENT_CLIENT_FOCUS_CHANGE ",");
   puts("                                  " IPC_EVENT_MONITOR_FOCUS_CHANGE ",");
   puts("                                  " IPC_EVENT_FOCUSED_TITLE_CHANGE ",");
-  puts("                                  " IPC_EVENT_FOCUSED_STATE_CHANGE);
+  puts("                                  " IPC_EVENT_FOCUSED_STATE_CHANGE ",");
+  puts("                                  " IPC_EVENT_STATE_CHANGE);
+  puts("                                  An event may be followed by");
+  puts("                                  :<field>,... to only report");
+  puts("                                  changes of those fields, e.g.");
+  puts("                                  " IPC_EVENT_TAG_CHANGE ":urgent.");
+  puts("                                  --monitor <n> before the events");
+  puts("                                  limits them to monitor n, -1 for");
+  puts("                                  all monitors.");
+  puts("");
+  puts("  bench <count> <name> [args...]  Time count round trips of a command");
+  puts("                                  over JSON and over the binary");
+  puts("                                  protocol. The command really runs.");
   puts("");
   puts("  help                            Display this message");
   puts("");
   puts("Options:");
   puts("  --ignore-reply                  Don't print reply messages from");
-  puts("                                  run_command and subscribe.");
+  puts("                                  run_command, run_batch and");
+  puts("                                  subscribe.");
+  puts("  --compact                       Ask dwm for compact JSON replies");
+  puts("                                  instead of indented ones.");
+  puts("  --pretty                        Ask dwm for indented JSON events");
+  puts("                                  instead of compact ones.");
+  puts("  --stdin                         Read one command per line from");
+  puts("                                  stdin and send them all over one");
+  puts("                                  connection, e.g. \"run_command");
+  puts("                                  view 2\" or \"get_tags\". Replies");
+  puts("                                  are printed in order, followed by");
+  puts("                                  latency percentiles on stderr.");
   puts("");
 }
 
@@ -498,10 +1314,23 @@ main(int argc, char *argv[])
     return 1;
   }
 
-  int i = 1;
-  if (i < argc && strcmp(argv[i], "--ignore-reply") == 0) {
-    ignore_reply = 1;
-    i++;
+  int i = 1, from_stdin = 0;
+  for (; i < argc && strncmp(argv[i], "--", 2) == 0; i++) {
+    if (strcmp(argv[i], "--ignore-reply") == 0)
+      ignore_reply = 1;
+    else if (strcmp(argv[i], "--stdin") == 0)
+      from_stdin = 1;
+    else if (strcmp(argv[i], "--compact") == 0)
+      set_encoding("compact");
+    else if (strcmp(argv[i], "--pretty") == 0)
+      set_encoding("pretty");
+    else
+      usage_error(prog_name, "Invalid option '%s'", argv[i]);
+  }
+
+  if (from_stdin) {
+    if (i < argc) usage_error(prog_name, "Unexpected argument with --stdin");
+    return run_stdin();
   }
 
   if (i >= argc) usage_error(prog_name, "Expected an argument, got none");
@@ -517,12 +1346,32 @@ main(int argc, char *argv[])
     // Number of command arguments
     int command_argc = argc - i;
     run_command(command, command_args, command_argc);
+  } else if (strcmp(argv[i], "run_batch") == 0) {
+    if (++i >= argc) usage_error(prog_name, "No commands specified");
+    run_batch(argv + i, argc - i);
+  } else if (strcmp(argv[i], "bench") == 0) {
+    if (i + 2 >= argc) usage_error(prog_name, "Expected count and command");
+    if (!is_unsigned_int(argv[i + 1]) || atol(argv[i + 1]) <= 0)
+      usage_error(prog_name, "Expected a positive count");
+    return bench(atol(argv[i + 1]), argv[i + 2], argv + i + 3, argc - i - 3);
   } else if (strcmp(argv[i], "get_monitors") == 0) {
-    get_monitors();
+    if (++i < argc) {
+      if (is_unsigned_int(argv[i]))
+        get_monitors_since(strtoul(argv[i], NULL, 10));
+      else
+        usage_error(prog_name, "Expected unsigned integer generation");
+    } else
+      get_monitors();
   } else if (strcmp(argv[i], "get_tags") == 0) {
     get_tags();
   } else if (strcmp(argv[i], "get_layouts") == 0) {
     get_layouts();
+  } else if (strcmp(argv[i], "get_stats") == 0) {
+    get_stats();
+  } else if (strcmp(argv[i], "get_ipc_clients") == 0) {
+    get_ipc_clients();
+  } else if (strcmp(argv[i], "get_state") == 0) {
+    return get_state();
   } else if (strcmp(argv[i], "get_dwm_client") == 0) {
     if (++i < argc) {
       if (is_unsigned_int(argv[i])) {
@@ -533,10 +1382,20 @@ main(int argc, char *argv[])
     } else
       usage_error(prog_name, "Expected the window id");
   } else if (strcmp(argv[i], "subscribe") == 0) {
-    if (++i < argc) {
-      for (int j = i; j < argc; j++) subscribe(argv[j]);
-    } else
-      usage_error(prog_name, "Expected event name");
+    int has_monitor = 0, monitor = -1, events = 0;
+    for (++i; i < argc; i++) {
+      if (strcmp(argv[i], "--monitor") == 0) {
+        if (++i >= argc || (!is_unsigned_int(argv[i]) &&
+                            strcmp(argv[i], "-1") != 0))
+          usage_error(prog_name, "Expected monitor number or -1");
+        has_monitor = 1;
+        monitor = atoi(argv[i]);
+      } else {
+        subscribe(argv[i], has_monitor, monitor);
+        events++;
+      }
+    }
+    if (events == 0) usage_error(prog_name, "Expected event name");
     // Keep listening for events forever
     while (1) {
       print_socket_reply();
@@ -21,12 +21,14 @@
  * To understand everything else, start reading main().
  */
 #include <errno.h>
+#include <fcntl.h>
 #include <locale.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <ctype.h>
 #include <inttypes.h>
@@ -49,6 +51,12 @@
 #include <sys/sysctl.h>
 #include <kvm.h>
 #endif /* __OpenBSD */
+#ifdef PROCCONN
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#endif /* PROCCONN */
 
 #include "drw.h"
 #include "util.h"
@@ -59,6 +67,7 @@
 #define INTERSECT(x,y,w,h,m)    (MAX(0, MIN((x)+(w),(m)->mx+(m)->mw) - MAX((x),(m)->mx)) \
                                * MAX(0, MIN((y)+(h),(m)->my+(m)->mh) - MAX((y),(m)->my)))
 #define ISVISIBLE(C)            ((C->tags & C->mon->tagset[C->mon->seltags]))
+#define ISTILED(M)              ((M)->lt[(M)->sellt]->arrange || (M)->lt[(M)->sellt]->compute)
 #define LENGTH(X)               (sizeof X / sizeof X[0])
 #define MOUSEMASK               (BUTTONMASK|PointerMotionMask)
 #define WIDTH(X)                ((X)->w + 2 * (X)->bw)
@@ -94,11 +103,13 @@ enum { NetSupported, NetWMName, NetWMState, NetWMCheck,
        NetSystemTray, NetSystemTrayOP, NetSystemTrayOrientation, NetSystemTrayOrientationHorz, NetSystemTrayVisual, NetWMWindowTypeDock,
        NetWMWindowsOpacity,
        NetWMFullscreen, NetActiveWindow, NetWMWindowType,
-       NetWMWindowTypeDialog, NetClientList, NetLast }; /* EWMH atoms */
+       NetWMWindowTypeDialog, NetClientList, NetClientListStacking, NetLast }; /* EWMH atoms */
 enum { Manager, Xembed, XembedInfo, XLast }; /* Xembed atoms */
 enum { WMProtocols, WMDelete, WMState, WMTakeFocus, WMLast }; /* default atoms */
 enum { ClkTagBar, ClkLtSymbol, ClkStatusText, ClkWinTitle,
        ClkClientWin, ClkRootWin, ClkLast }; /* clicks */
+enum { PropNetWMName, PropWMName, PropTransient, PropClass, PropNetWMState,
+       PropNetWMWindowType, PropNormalHints, PropHints, PropLast }; /* prefetched properties */
 
 typedef struct TagState TagState;
 struct TagState {
@@ -139,6 +150,8 @@ struct Client {
 	int bw, oldbw;
 	unsigned int tags;
 	int isfixed, isfloating, isurgent, neverfocus, oldstate, isfullscreen, isterminal, noswallow;
+	int configpending; /* geometry not yet sent, see configurebegin() */
+	int cfgx, cfgy, cfgw, cfgh, cfgbw; /* geometry last sent, cfgw < 0 if unknown */
 	pid_t pid;
 	Client *next;
 	Client *snext;
@@ -147,6 +160,8 @@ struct Client {
 	Monitor *mon;
 	Window win;
 	ClientState prevstate;
+	unsigned long ipcgen; /* last IPC generation it changed in */
+	uint64_t ipchash;     /* see ipc_update_generations() */
 	Bool isLeft; /* If set the client should be placed in the left column */
 };
 
@@ -157,17 +172,55 @@ typedef struct {
 	const Arg arg;
 } Key;
 
+/* Snapshot of a monitor and of its tiled clients handed to the compute
+ * callback of a layout, see layoutapply() */
+typedef struct {
+	int mx, my, mw, mh;   /* screen size */
+	int wx, wy, ww, wh;   /* window area  */
+	int bh;               /* smallest client width and height */
+	int nmaster, nmastercols, nrightcols;
+	float mfact;
+	float colfact[3];
+	unsigned int nvisible; /* visible clients, floating ones included */
+} LayoutMonitor;
+
+typedef struct {
+	float cfact;
+	int isleft;
+	int x, y, w, h, bw;   /* current geometry */
+	float mina, maxa;
+	int basew, baseh, incw, inch, maxw, maxh, minw, minh;
+} LayoutClient;
+
+enum { RectPlaced = 1 << 0, RectLast = 1 << 1 }; /* LayoutRect flags */
+
+/* Geometry a compute callback asks resize() for. Clients whose rect lacks
+ * RectPlaced are left alone, RectLast moves the client to the end of the
+ * client list. */
+typedef struct {
+	int x, y, w, h;
+	unsigned int flags;
+} LayoutRect;
+
+#define LTSYMBOLSIZE 16
+
+typedef void (*LayoutCompute)(const LayoutMonitor *lm, const LayoutClient *lc, unsigned int n, LayoutRect *r, char *symbol);
+
+/* Layouts with a compute callback are arranged through it; arrange is kept
+ * for layouts without one. A layout with neither is the floating layout, use
+ * ISTILED() to tell them apart */
 typedef struct {
 	const char *symbol;
 	void (*arrange)(Monitor *);
+	LayoutCompute compute;
 } Layout;
 
 #define MAX_TAGLEN 16
 
 
 struct Monitor {
-	char ltsymbol[16];
-	char lastltsymbol[16];
+	char ltsymbol[LTSYMBOLSIZE];
+	char lastltsymbol[LTSYMBOLSIZE];
 	float mfact;
 	int nmaster;
 	int num;
@@ -178,7 +231,12 @@ struct Monitor {
 	unsigned int seltags;
 	unsigned int sellt;
 	unsigned int tagset[2];
+	unsigned int occ, urg;             /* occupied and urgent tags, see tagcount() */
+	int needarrange, needrestack;      /* deferred, see arrangebegin() */
+	unsigned int ntagged[32], nurgent[32];
 	TagState tagstate;
+	unsigned long ipcgen; /* last IPC generation it changed in */
+	uint64_t ipchash;     /* see ipc_update_generations() */
 	int showbar;
 	int topbar;
 	Client *clients;
@@ -216,10 +274,46 @@ typedef struct {
 	Bool isLeft;
 } Rule;
 
+/* Window keyed index, open addressing with linear probing. A slot with a
+ * window but no client is a tombstone left behind by winindexdel(). */
+typedef struct {
+	Window win;
+	Client *c;
+} WinSlot;
+
+typedef struct {
+	WinSlot *slots;
+	unsigned int size, used, dead;
+} WinIndex;
+
+/* properties manage() needs, requested up front to pay one round trip */
+typedef struct {
+	xcb_get_property_reply_t *prop[PropLast];
+	pid_t pid;
+} Prefetch;
+
+typedef struct {
+	xcb_get_window_attributes_cookie_t attrck;
+	xcb_get_geometry_cookie_t geomck;
+	xcb_get_property_cookie_t transck, stateck, classck;
+	xcb_get_window_attributes_reply_t *attr;
+	xcb_get_geometry_reply_t *geom;
+	xcb_get_property_reply_t *trans, *state, *class;
+} ScanWin;
+
+/* counters reported by the IPC get_stats message */
+typedef struct {
+	unsigned long configissued, configskipped;
+} Stats;
+
 /* function declarations */
+static void applyclassrules(Client *c, const char *class, const char *instance);
+static void applygaps(int mx, int my, int mw, int mh, int isfloating, int *x, int *y, int *w, int *h);
 static void applyrules(Client *c);
 static int applysizehints(Client *c, int *x, int *y, int *w, int *h, int interact);
 static void arrange(Monitor *m);
+static void arrangebegin(void);
+static void arrangeend(void);
 static void arrangemon(Monitor *m);
 static void attach(Client *c);
 static void attachBelow(Client *c);
@@ -229,13 +323,19 @@ static void changeopacity(const Arg *arg);
 static void checkotherwm(void);
 static void cleanup(void);
 static void cleanupmon(Monitor *mon);
+static void clientlistreserve(void);
 static void clientmessage(XEvent *e);
 static void configure(Client *c);
+static void configurebegin(void);
+static void configureend(void);
+static void configureflush(void);
 static void configurenotify(XEvent *e);
 static void configurerequest(XEvent *e);
+static int configurewindow(Client *c);
 static Monitor *createmon(void);
 static void destroynotify(XEvent *e);
 static void detach(Client *c);
+static void decodetextprop(XTextProperty *name, char *text, unsigned int size);
 static void detachstack(Client *c);
 static Monitor *dirtomon(int dir);
 static void drawbar(Monitor *m);
@@ -248,7 +348,6 @@ static void focusmon(const Arg *arg);
 static void focusstack(const Arg *arg);
 static Atom getatomprop(Client *c, Atom prop);
 static int getrootptr(int *x, int *y);
-static long getstate(Window w);
 static int gettextprop(Window w, Atom atom, char *text, unsigned int size);
 static void grabbuttons(Client *c, int focused);
 static void grabkeys(void);
@@ -256,19 +355,30 @@ static int handlexevent(struct epoll_event *ev);
 static void incnmaster(const Arg *arg);
 static void keypress(XEvent *e);
 static void killclient(const Arg *arg);
+static void layoutapply(Monitor *m, LayoutCompute compute);
+static void layoutclient(Client *c, LayoutClient *lc);
+static LayoutRect layoutfit(const LayoutMonitor *lm, const LayoutClient *lc, LayoutRect r);
+static void layoutmonitor(Monitor *m, LayoutMonitor *lm);
 static void manage(Window w, XWindowAttributes *wa);
 static void managealtbar(Window win, XWindowAttributes *wa);
 static void managetray(Window win, XWindowAttributes *wa);
 static void mappingnotify(XEvent *e);
 static void maprequest(XEvent *e);
 static void monocle(Monitor *m);
+static void monoclerects(const LayoutMonitor *lm, const LayoutClient *lc, unsigned int n, LayoutRect *r, char *symbol);
 static void motionnotify(XEvent *e);
 static void movemouse(const Arg *arg);
 static Client *nexttiled(Client *c);
 static void opacity(Client *c, double opacity);
 static void pop(Client *);
+static void prefetch(Window w, Prefetch *pf);
 static void propertynotify(XEvent *e);
 static void quit(const Arg *arg);
+static void replyclass(xcb_get_property_reply_t *r, char *class, char *instance, size_t size);
+static int replysizehints(xcb_get_property_reply_t *r, XSizeHints *size);
+static int replytextprop(xcb_get_property_reply_t *r, char *text, unsigned int size);
+static void *replyvalue(xcb_get_property_reply_t *r, Atom type, int format, int n);
+static int replywmhints(xcb_get_property_reply_t *r, XWMHints *wmh);
 static Monitor *recttomon(int x, int y, int w, int h);
 static void resize(Client *c, int x, int y, int w, int h, int interact);
 static void resizeclient(Client *c, int x, int y, int w, int h);
@@ -284,18 +394,24 @@ static void setfocus(Client *c);
 static void setfullscreen(Client *c, int fullscreen);
 static void setlayout(const Arg *arg);
 static void setlayoutsafe(const Arg *arg);
+static void setsizehints(Client *c, XSizeHints *hints);
 static void setcfact(const Arg *arg);
 static void setmfact(const Arg *arg);
 static void setup(void);
 static void setupepoll(void);
 static void seturgent(Client *c, int urg);
+static void setwindowtype(Client *c, Atom state, Atom wtype);
+static void setwmhints(Client *c, XWMHints *wmh);
 static void showhide(Client *c);
+static void sizehints(const LayoutClient *lc, int *w, int *h);
 static void sigchld(int unused);
 static void spawn(const Arg *arg);
 static void spawnbar();
 static void tag(const Arg *arg);
+static void tagcount(Client *c, int delta);
 static void tagmon(const Arg *arg);
 static void tile(Monitor *);
+static void tilerects(const LayoutMonitor *lm, const LayoutClient *lc, unsigned int n, LayoutRect *r, char *symbol);
 static void togglebar(const Arg *arg);
 static void togglefloating(const Arg *arg);
 static void togglefullscr(const Arg *arg);
@@ -309,6 +425,7 @@ static void unmapnotify(XEvent *e);
 static void updatebarpos(Monitor *m);
 static void updatebars(void);
 static void updateclientlist(void);
+static void updateclientstacking(void);
 static int updategeom(void);
 static void updatenumlockmask(void);
 static void updatesizehints(Client *c);
@@ -317,6 +434,10 @@ static void updatetitle(Client *c);
 static void updatewindowtype(Client *c);
 static void updatewmhints(Client *c);
 static void view(const Arg *arg);
+static void winindexadd(WinIndex *ix, Window w, Client *c);
+static void winindexdel(WinIndex *ix, Window w);
+static Client *winindexget(WinIndex *ix, Window w);
+static void winindexresize(WinIndex *ix, unsigned int size);
 static Client *wintoclient(Window w);
 static Monitor *wintomon(Window w);
 static int wmclasscontains(Window win, const char *class, const char *name);
@@ -327,10 +448,16 @@ static void xinitvisual();
 static void zoom(const Arg *arg);
 
 static pid_t getparentprocess(pid_t p);
+static void pidcachedrop(pid_t p);
+#ifdef PROCCONN
+static void procconnevent(void);
+static void setupprocconn(void);
+#endif /* PROCCONN */
 static int isdescprocess(pid_t p, pid_t c);
 static Client *swallowingclient(Window w);
 static Client *termforwin(const Client *c);
-static pid_t winpid(Window w);
+static pid_t winpid(Window w, xcb_res_query_client_ids_cookie_t ck);
+static xcb_res_query_client_ids_cookie_t winpidquery(Window w);
 
 static void keyrelease(XEvent *e);
 static void combotag(const Arg *arg);
@@ -366,7 +493,14 @@ static void (*handler[LASTEvent]) (XEvent *) = {
 static Atom wmatom[WMLast], netatom[NetLast], xatom[XLast];
 static int epoll_fd;
 static int dpy_fd;
+#ifdef PROCCONN
+static int procconn_fd = -1;
+#endif /* PROCCONN */
 static int running = 1;
+static int arrangedepth = 0;  /* nesting of arrangebegin() */
+static int configdepth = 0;   /* nesting of configurebegin() */
+static int configqueued = 0;  /* some client has configpending set */
+static Stats stats;
 static Cur *cursor[CurLast];
 static Clr **scheme;
 static Display *dpy;
@@ -374,6 +508,22 @@ static Drw *drw;
 static Monitor *mons, *selmon, *lastselmon;
 static Window root, wmcheckwin;
 
+static WinIndex clientindex;  /* managed window -> client */
+static WinIndex swallowindex; /* swallowed window -> swallowing terminal */
+static Window *clientlist;    /* scratch for the _NET_CLIENT_LIST properties */
+static unsigned int clientlistsz;
+static Client **layouttiled;   /* scratch for layoutapply() */
+static LayoutClient *layoutclients;
+static LayoutRect *layoutrects;
+static unsigned int layoutsz;
+
+/* pid -> parent pid cache used by terminal swallowing, direct mapped and
+ * kept current by the proc connector */
+typedef struct {
+	pid_t pid, ppid;
+} PidSlot;
+static PidSlot pidcache[1024];
+
 #include "ipc.h"
 
 static xcb_connection_t *xcon;
@@ -406,12 +556,14 @@ keyrelease(XEvent *e) {
 void
 combotag(const Arg *arg) {
 	if(selmon->sel && arg->ui & TAGMASK) {
+		tagcount(selmon->sel, -1);
 		if (combo) {
 			selmon->sel->tags |= arg->ui & TAGMASK;
 		} else {
 			combo = 1;
 			selmon->sel->tags = arg->ui & TAGMASK;
 		}
+		tagcount(selmon->sel, +1);
 		focus(NULL);
 		arrange(selmon);
 	}
@@ -485,21 +637,16 @@ comboview(const Arg *arg) {
 
 
 void
-applyrules(Client *c)
+applyclassrules(Client *c, const char *class, const char *instance)
 {
-	const char *class, *instance;
 	unsigned int i;
 	const Rule *r;
 	Monitor *m;
-	XClassHint ch = { NULL, NULL };
 
 	/* rule matching */
 	c->isfloating = 0;
 	c->tags = 0;
 	c->opacity = defaultopacity;
-	XGetClassHint(dpy, c->win, &ch);
-	class    = ch.res_class ? ch.res_class : broken;
-	instance = ch.res_name  ? ch.res_name  : broken;
 
 	for (i = 0; i < LENGTH(rules); i++) {
 		r = &rules[i];
@@ -518,10 +665,6 @@ applyrules(Client *c)
 				c->mon = m;
 		}
 	}
-	if (ch.res_class)
-		XFree(ch.res_class);
-	if (ch.res_name)
-		XFree(ch.res_name);
 
 	// c->tags = c->tags & TAGMASK ? c->tags & TAGMASK : c->mon->tagset[c->mon->seltags];
 	c->tags = c->tags & TAGMASK;
@@ -533,10 +676,92 @@ applyrules(Client *c)
 	}
 }
 
+void
+applyrules(Client *c)
+{
+	XClassHint ch = { NULL, NULL };
+
+	XGetClassHint(dpy, c->win, &ch);
+	applyclassrules(c, ch.res_class ? ch.res_class : broken,
+		ch.res_name ? ch.res_name : broken);
+	if (ch.res_class)
+		XFree(ch.res_class);
+	if (ch.res_name)
+		XFree(ch.res_name);
+}
+
+/* Shrink the geometry resizeclient() is asked for by the gaps between
+ * clients. Gaps are dropped along the edges of the monitor. */
+void
+applygaps(int mx, int my, int mw, int mh, int isfloating, int *x, int *y, int *w, int *h)
+{
+	int					lgappx	= gappx;
+	int					gapN, gapE, gapW;
+	int					edges	= 0;
+	int					margin;
+
+	if (mw <= 1024 || mh <= 1024) {
+		lgappx = 0;
+	}
+
+	margin = lgappx * 2;
+
+	/*
+		Clients are generally arranged relative to the client above them, so
+		include the entire gap to account for the one below it.
+	*/
+	gapN = lgappx;
+
+	gapE = lgappx / 2;
+	gapW = lgappx - gapE;
+
+
+	/*
+		Adjust gaps for any edge of a client that is next to the edge of the
+		monitor.
+	*/
+	if ((mx + mw) - (*x + *w) < margin) {
+		gapE = 0;
+		edges++;
+	}
+	if ((my + mh) - (*y + *h) < margin) {
+		edges++;
+	}
+
+	if ((*x - mx) < margin) {
+		gapW = 0;
+		edges++;
+	}
+	if ((*y - my) < margin) {
+		gapN = 0;
+		edges++;
+	}
+
+	if (isfloating || edges >= 4) {
+		gapN = gapE = gapW = 0;
+	} else {
+		/*
+			MNG Hack
+
+			I am using picom/compton to show a "shadow" on just the bottom edge
+			as if it was a 1px border. But, I need a place to show this so steal
+			1px from the gapN.
+
+			This is very hacky, but works for my usecase.
+		*/
+		(*h)--;
+	}
+
+	*x += gapW;
+	*y += gapN;
+	*w -= gapW + gapE;
+	*h -= gapN;
+}
+
 int
 applysizehints(Client *c, int *x, int *y, int *w, int *h, int interact)
 {
-	int baseismin;
+	LayoutClient lc;
 	Monitor *m = c->mon;
 
 	/* set minimum possible */
@@ -565,36 +790,9 @@ applysizehints(Client *c, int *x, int *y, int *w, int *h, int interact)
 		*h = bh;
 	if (*w < bh)
 		*w = bh;
-	if (resizehints || c->isfloating || !c->mon->lt[c->mon->sellt]->arrange) {
-		/* see last two sentences in ICCCM 4.1.2.3 */
-		baseismin = c->basew == c->minw && c->baseh == c->minh;
-		if (!baseismin) { /* temporarily remove base dimensions */
-			*w -= c->basew;
-			*h -= c->baseh;
-		}
-		/* adjust for aspect limits */
-		if (c->mina > 0 && c->maxa > 0) {
-			if (c->maxa < (float)*w / *h)
-				*w = *h * c->maxa + 0.5;
-			else if (c->mina < (float)*h / *w)
-				*h = *w * c->mina + 0.5;
-		}
-		if (baseismin) { /* increment calculation requires this */
-			*w -= c->basew;
-			*h -= c->baseh;
-		}
-		/* adjust for increment value */
-		if (c->incw)
-			*w -= *w % c->incw;
-		if (c->inch)
-			*h -= *h % c->inch;
-		/* restore base dimensions */
-		*w = MAX(*w + c->basew, c->minw);
-		*h = MAX(*h + c->baseh, c->minh);
-		if (c->maxw)
-			*w = MIN(*w, c->maxw);
-		if (c->maxh)
-			*h = MIN(*h, c->maxh);
+	if (resizehints || c->isfloating || !ISTILED(c->mon)) {
+		layoutclient(c, &lc);
+		sizehints(&lc, w, h);
 	}
 	return *x != c->x || *y != c->y || *w != c->w || *h != c->h;
 }
@@ -602,6 +800,14 @@ applysizehints(Client *c, int *x, int *y, int *w, int *h, int interact)
 void
 arrange(Monitor *m)
 {
+	if (arrangedepth) {
+		if (m)
+			m->needarrange = 1;
+		else for (m = mons; m; m = m->next)
+			m->needarrange = 1;
+		return;
+	}
+	configurebegin();
 	if (m)
 		showhide(m->stack);
 	else for (m = mons; m; m = m->next)
@@ -611,13 +817,44 @@ arrange(Monitor *m)
 		restack(m);
 	} else for (m = mons; m; m = m->next)
 		arrangemon(m);
+	configureend();
+}
+
+/* Between arrangebegin() and the matching arrangeend() arrange() and restack()
+ * only mark the monitor, every marked monitor is arranged or restacked once
+ * when the outermost transaction ends. */
+void
+arrangebegin(void)
+{
+	arrangedepth++;
+}
+
+void
+arrangeend(void)
+{
+	Monitor *m;
+
+	if (--arrangedepth > 0)
+		return;
+	configurebegin();
+	for (m = mons; m; m = m->next) {
+		if (m->needarrange)
+			arrange(m);
+		else if (m->needrestack)
+			restack(m);
+		m->needarrange = m->needrestack = 0;
+	}
+	configureend();
 }
 
 void
 arrangemon(Monitor *m)
 {
+	ipc_state_mark_dirty();
 	strncpy(m->ltsymbol, m->lt[m->sellt]->symbol, sizeof m->ltsymbol);
-	if (m->lt[m->sellt]->arrange)
+	if (m->lt[m->sellt]->compute)
+		layoutapply(m, m->lt[m->sellt]->compute);
+	else if (m->lt[m->sellt]->arrange)
 		m->lt[m->sellt]->arrange(m);
 }
 
@@ -659,6 +896,7 @@ swallow(Client *p, Client *c)
 	if (c->noswallow && !swallowfloating && c->isfloating)
 		return;
 
+	tagcount(c, -1);
 	detach(c);
 	detachstack(c);
 
@@ -671,10 +909,16 @@ swallow(Client *p, Client *c)
 	Window w = p->win;
 	p->win = c->win;
 	c->win = w;
+	winindexdel(&clientindex, c->win);
+	winindexadd(&clientindex, p->win, p);
+	winindexadd(&swallowindex, c->win, p);
 	updatetitle(p);
 	XMoveResizeWindow(dpy, p->win, p->x, p->y, p->w, p->h);
+	p->cfgw = -1;
 	arrange(p->mon);
+	tagcount(p, -1);
 	applyrules(p);
+	tagcount(p, +1);
 	configure(p);
 	updateclientlist();
 }
@@ -682,8 +926,13 @@ swallow(Client *p, Client *c)
 void
 unswallow(Client *c)
 {
+	winindexdel(&clientindex, c->win);
+	winindexdel(&swallowindex, c->swallowing->win);
 	c->win = c->swallowing->win;
+	winindexadd(&clientindex, c->win, c);
+	c->cfgw = -1;
 
+	pidcachedrop(c->swallowing->pid);
 	free(c->swallowing);
 	c->swallowing = NULL;
 
@@ -787,12 +1036,19 @@ cleanup(void)
 	for (i = 0; i < LENGTH(colors) + 1; i++)
 		free(scheme[i]);
 	XDestroyWindow(dpy, wmcheckwin);
+	free(clientindex.slots);
+	free(swallowindex.slots);
+	free(clientlist);
 	drw_free(drw);
 	XSync(dpy, False);
 	XSetInputFocus(dpy, PointerRoot, RevertToPointerRoot, CurrentTime);
 	XDeleteProperty(dpy, root, netatom[NetActiveWindow]);
 
 	ipc_cleanup();
+#ifdef PROCCONN
+	if (procconn_fd >= 0)
+		close(procconn_fd);
+#endif /* PROCCONN */
 
 	if (close(epoll_fd) < 0) {
 			fprintf(stderr, "Failed to close epoll file descriptor\n");
@@ -836,6 +1092,23 @@ clientmessage(XEvent *e)
 	}
 }
 
+void
+clientlistreserve(void)
+{
+	Client *c;
+	Monitor *m;
+	unsigned int n = 0;
+
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next)
+			n++;
+	if (n > clientlistsz) {
+		free(clientlist);
+		clientlistsz = MAX(n, 2 * clientlistsz);
+		clientlist = ecalloc(clientlistsz, sizeof(Window));
+	}
+}
+
 void
 configure(Client *c)
 {
@@ -855,6 +1128,39 @@ configure(Client *c)
 	XSendEvent(dpy, c->win, False, StructureNotifyMask, (XEvent *)&ce);
 }
 
+/* Between configurebegin() and the matching configureend() resizeclient()
+ * only records the new geometry, the windows are configured and the server
+ * synced once when the outermost transaction ends. */
+void
+configurebegin(void)
+{
+	configdepth++;
+}
+
+void
+configureend(void)
+{
+	if (--configdepth > 0 || !configqueued)
+		return;
+	configureflush();
+	XSync(dpy, False);
+}
+
+void
+configureflush(void)
+{
+	Monitor *m;
+	Client *c;
+
+	if (!configqueued)
+		return;
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next)
+			if (c->configpending)
+				configurewindow(c);
+	configqueued = 0;
+}
+
 void
 configurenotify(XEvent *e)
 {
@@ -892,9 +1198,10 @@ configurerequest(XEvent *e)
 	XWindowChanges wc;
 
 	if ((c = wintoclient(ev->window))) {
-		if (ev->value_mask & CWBorderWidth)
+		if (ev->value_mask & CWBorderWidth) {
 			c->bw = ev->border_width;
-		else if (c->isfloating || !selmon->lt[selmon->sellt]->arrange) {
+			ipc_state_mark_dirty();
+		} else if (c->isfloating || !ISTILED(selmon)) {
 			m = c->mon;
 			if (ev->value_mask & CWX) {
 				c->oldx = c->x;
@@ -920,6 +1227,7 @@ configurerequest(XEvent *e)
 				configure(c);
 			if (ISVISIBLE(c))
 				XMoveResizeWindow(dpy, c->win, c->x, c->y, c->w, c->h);
+			c->cfgw = -1;
 		} else
 			configure(c);
 	} else {
@@ -935,6 +1243,28 @@ configurerequest(XEvent *e)
 	XSync(dpy, False);
 }
 
+int
+configurewindow(Client *c)
+{
+	XWindowChanges wc;
+
+	c->configpending = 0;
+	if (c->cfgw >= 0 && c->cfgx == c->x && c->cfgy == c->y
+	&& c->cfgw == c->w && c->cfgh == c->h && c->cfgbw == c->bw) {
+		stats.configskipped++;
+		return 0;
+	}
+	wc.x = c->cfgx = c->x;
+	wc.y = c->cfgy = c->y;
+	wc.width = c->cfgw = c->w;
+	wc.height = c->cfgh = c->h;
+	wc.border_width = c->cfgbw = c->bw;
+	XConfigureWindow(dpy, c->win, CWX|CWY|CWWidth|CWHeight|CWBorderWidth, &wc);
+	configure(c);
+	stats.configissued++;
+	return 1;
+}
+
 Monitor *
 createmon(void)
 {
@@ -1001,6 +1331,23 @@ detachstack(Client *c)
 	}
 }
 
+void
+decodetextprop(XTextProperty *name, char *text, unsigned int size)
+{
+	char **list = NULL;
+	int n;
+
+	if (name->encoding == XA_STRING)
+		strncpy(text, (char *)name->value, size - 1);
+	else {
+		if (XmbTextPropertyToTextList(dpy, name, &list, &n) >= Success && n > 0 && *list) {
+			strncpy(text, *list, size - 1);
+			XFreeStringList(list);
+		}
+	}
+	text[size - 1] = '\0';
+}
+
 Monitor *
 dirtomon(int dir)
 {
@@ -1063,6 +1410,7 @@ expose(XEvent *e)
 void
 focus(Client *c)
 {
+	ipc_state_mark_dirty();
 	if (!c || !ISVISIBLE(c))
 		for (c = selmon->stack; c && !ISVISIBLE(c); c = c->snext);
 	if (selmon->sel && selmon->sel != c)
@@ -1172,29 +1520,9 @@ getrootptr(int *x, int *y)
 	return XQueryPointer(dpy, root, &dummy, &dummy, x, y, &di, &di, &dui);
 }
 
-long
-getstate(Window w)
-{
-	int format;
-	long result = -1;
-	unsigned char *p = NULL;
-	unsigned long n, extra;
-	Atom real;
-
-	if (XGetWindowProperty(dpy, w, wmatom[WMState], 0L, 2L, False, wmatom[WMState],
-		&real, &format, &n, &extra, (unsigned char **)&p) != Success)
-		return -1;
-	if (n != 0)
-		result = *p;
-	XFree(p);
-	return result;
-}
-
 int
 gettextprop(Window w, Atom atom, char *text, unsigned int size)
 {
-	char **list = NULL;
-	int n;
 	XTextProperty name;
 
 	if (!text || size == 0)
@@ -1202,15 +1530,7 @@ gettextprop(Window w, Atom atom, char *text, unsigned int size)
 	text[0] = '\0';
 	if (!XGetTextProperty(dpy, w, &name, atom) || !name.nitems)
 		return 0;
-	if (name.encoding == XA_STRING)
-		strncpy(text, (char *)name.value, size - 1);
-	else {
-		if (XmbTextPropertyToTextList(dpy, &name, &list, &n) >= Success && n > 0 && *list) {
-			strncpy(text, *list, size - 1);
-			XFreeStringList(list);
-		}
-	}
-	text[size - 1] = '\0';
+	decodetextprop(&name, text, size);
 	XFree(name.value);
 	return 1;
 }
@@ -1218,7 +1538,7 @@ gettextprop(Window w, Atom atom, char *text, unsigned int size)
 void
 grabbuttons(Client *c, int focused)
 {
-	updatenumlockmask();
+	/* numlockmask is kept current by grabkeys() */
 	{
 		unsigned int i, j;
 		unsigned int modifiers[] = { 0, LockMask, numlockmask, numlockmask|LockMask };
@@ -1259,13 +1579,18 @@ handlexevent(struct epoll_event *ev)
 {
 	if (ev->events & EPOLLIN) {
 		XEvent ev;
+		int handled = 0;
+
 		while (running && XPending(dpy)) {
 			XNextEvent(dpy, &ev);
 			if (handler[ev.type]) {
 				handler[ev.type](&ev); /* call handler */
-				ipc_send_events(mons, &lastselmon, selmon);
+				handled = 1;
 			}
 		}
+		/* report state changes once per batch of events */
+		if (handled)
+			ipc_send_events(mons, &lastselmon, selmon);
 	} else if (ev-> events & EPOLLHUP) {
 		return -1;
 	}
@@ -1324,16 +1649,144 @@ killclient(const Arg *arg)
 	}
 }
 
+/* Arrange the tiled clients of m in two phases: compute only looks at a
+ * snapshot of the monitor and its clients and returns their geometry, the
+ * X work and the client list changes happen afterwards. */
+void
+layoutapply(Monitor *m, LayoutCompute compute)
+{
+	LayoutMonitor lm;
+	LayoutRect *r;
+	Client *c, **tail;
+	unsigned int i, n;
+
+	for (n = 0, c = nexttiled(m->clients); c; c = nexttiled(c->next), n++);
+	if (n > layoutsz) {
+		layoutsz = MAX(n, 2 * layoutsz);
+		if (!(layouttiled = realloc(layouttiled, layoutsz * sizeof(Client *)))
+		|| !(layoutclients = realloc(layoutclients, layoutsz * sizeof(LayoutClient)))
+		|| !(layoutrects = realloc(layoutrects, layoutsz * sizeof(LayoutRect))))
+			die("fatal: could not malloc() %u layout entries", layoutsz);
+	}
+	layoutmonitor(m, &lm);
+	for (i = 0, c = nexttiled(m->clients); c; c = nexttiled(c->next), i++) {
+		layouttiled[i] = c;
+		layoutclient(c, &layoutclients[i]);
+	}
+	if (n)
+		memset(layoutrects, 0, n * sizeof(LayoutRect));
+
+	compute(&lm, layoutclients, n, layoutrects, m->ltsymbol);
+
+	for (i = 0; i < n; i++) {
+		r = &layoutrects[i];
+		if (r->flags & RectPlaced)
+			resize(layouttiled[i], r->x, r->y, r->w, r->h, 0);
+	}
+	for (i = 0; i < n; i++) {
+		if (!(layoutrects[i].flags & RectLast))
+			continue;
+		c = layouttiled[i];
+		detach(c);
+		for (tail = &m->clients; *tail; tail = &(*tail)->next);
+		*tail = c;
+		c->next = NULL;
+	}
+}
+
+void
+layoutclient(Client *c, LayoutClient *lc)
+{
+	lc->cfact = c->cfact;
+	lc->isleft = c->isLeft;
+	lc->x = c->x;
+	lc->y = c->y;
+	lc->w = c->w;
+	lc->h = c->h;
+	lc->bw = c->bw;
+	lc->mina = c->mina;
+	lc->maxa = c->maxa;
+	lc->basew = c->basew;
+	lc->baseh = c->baseh;
+	lc->incw = c->incw;
+	lc->inch = c->inch;
+	lc->maxw = c->maxw;
+	lc->maxh = c->maxh;
+	lc->minw = c->minw;
+	lc->minh = c->minh;
+}
+
+/* The geometry resize(c, r.x, r.y, r.w, r.h, 0) leaves a tiled client with,
+ * for layouts that place clients relative to the ones placed before. Must
+ * follow applysizehints() and resizeclient(). */
+LayoutRect
+layoutfit(const LayoutMonitor *lm, const LayoutClient *lc, LayoutRect r)
+{
+	r.w = MAX(1, r.w);
+	r.h = MAX(1, r.h);
+	if (r.x >= lm->wx + lm->ww)
+		r.x = lm->wx + lm->ww - (lc->w + 2 * lc->bw);
+	if (r.y >= lm->wy + lm->wh)
+		r.y = lm->wy + lm->wh - (lc->h + 2 * lc->bw);
+	if (r.x + r.w + 2 * lc->bw <= lm->wx)
+		r.x = lm->wx;
+	if (r.y + r.h + 2 * lc->bw <= lm->wy)
+		r.y = lm->wy;
+	if (r.h < lm->bh)
+		r.h = lm->bh;
+	if (r.w < lm->bh)
+		r.w = lm->bh;
+	if (resizehints)
+		sizehints(lc, &r.w, &r.h);
+	if (r.x == lc->x && r.y == lc->y && r.w == lc->w && r.h == lc->h)
+		return r; /* unchanged, resize() doesn't touch the client */
+	applygaps(lm->mx, lm->my, lm->mw, lm->mh, 0, &r.x, &r.y, &r.w, &r.h);
+	return r;
+}
+
+void
+layoutmonitor(Monitor *m, LayoutMonitor *lm)
+{
+	Client *c;
+
+	lm->mx = m->mx;
+	lm->my = m->my;
+	lm->mw = m->mw;
+	lm->mh = m->mh;
+	lm->wx = m->wx;
+	lm->wy = m->wy;
+	lm->ww = m->ww;
+	lm->wh = m->wh;
+	lm->bh = bh;
+	lm->nmaster = m->nmaster;
+	lm->nmastercols = m->nmastercols;
+	lm->nrightcols = m->nrightcols;
+	lm->mfact = m->mfact;
+	memcpy(lm->colfact, m->colfact, sizeof(lm->colfact));
+	for (lm->nvisible = 0, c = m->clients; c; c = c->next)
+		if (ISVISIBLE(c))
+			lm->nvisible++;
+}
+
 void
 manage(Window w, XWindowAttributes *wa)
 {
 	Client *c, *t = NULL, *term = NULL;
 	Window trans = None;
+	Atom state, wtype;
 	XWindowChanges wc;
+	XSizeHints size;
+	XWMHints wmh;
+	Prefetch pf;
+	char class[256], instance[256];
+	uint32_t *v;
+	int i;
 
+	prefetch(w, &pf);
 	c = ecalloc(1, sizeof(Client));
 	c->win = w;
-	c->pid = winpid(w);
+	c->cfgw = -1;
+	c->pid = pf.pid;
 	/* geometry */
 	c->x = c->oldx = wa->x;
 	c->y = c->oldy = wa->y;
@@ -1342,13 +1795,19 @@ manage(Window w, XWindowAttributes *wa)
 	c->oldbw = wa->border_width;
 	c->cfact = 1.0;
 
-	updatetitle(c);
-	if (XGetTransientForHint(dpy, w, &trans) && (t = wintoclient(trans))) {
+	if (!replytextprop(pf.prop[PropNetWMName], c->name, sizeof c->name))
+		replytextprop(pf.prop[PropWMName], c->name, sizeof c->name);
+	if (c->name[0] == '\0') /* hack to mark broken clients */
+		strcpy(c->name, broken);
+	if ((v = replyvalue(pf.prop[PropTransient], XA_WINDOW, 32, 1)))
+		trans = v[0];
+	if (trans != None && (t = wintoclient(trans))) {
 		c->mon = t->mon;
 		c->tags = t->tags;
 	} else {
 		c->mon = selmon;
-		applyrules(c);
+		replyclass(pf.prop[PropClass], class, instance, sizeof class);
+		applyclassrules(c, class, instance);
 		term = termforwin(c);
 	}
 	opacity(c, c->opacity);
@@ -1367,9 +1826,17 @@ manage(Window w, XWindowAttributes *wa)
 	XConfigureWindow(dpy, w, CWBorderWidth, &wc);
 	XSetWindowBorder(dpy, w, scheme[SchemeNorm][ColBorder].pixel);
 	configure(c); /* propagates border_width, if size doesn't change */
-	updatewindowtype(c);
-	updatesizehints(c);
-	updatewmhints(c);
+	state = (v = replyvalue(pf.prop[PropNetWMState], XA_ATOM, 32, 1)) ? v[0] : None;
+	wtype = (v = replyvalue(pf.prop[PropNetWMWindowType], XA_ATOM, 32, 1)) ? v[0] : None;
+	setwindowtype(c, state, wtype);
+	if (!replysizehints(pf.prop[PropNormalHints], &size))
+		/* size is uninitialized, ensure that size.flags aren't used */
+		size.flags = PSize;
+	setsizehints(c, &size);
+	if (replywmhints(pf.prop[PropHints], &wmh))
+		setwmhints(c, &wmh);
+	for (i = 0; i < PropLast; i++)
+		free(pf.prop[i]);
 	XSelectInput(dpy, w, EnterWindowMask|FocusChangeMask|PropertyChangeMask|StructureNotifyMask);
 	grabbuttons(c, 0);
 	if (!c->isfloating)
@@ -1381,6 +1848,8 @@ manage(Window w, XWindowAttributes *wa)
 	else
 		attach(c);
 	attachstack(c);
+	tagcount(c, +1);
+	winindexadd(&clientindex, c->win, c);
 	XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32, PropModeAppend,
 		(unsigned char *) &(c->win), 1);
 	XMoveResizeWindow(dpy, c->win, c->x + 2 * sw, c->y, c->w, c->h); /* some windows require this */
@@ -1440,7 +1909,7 @@ mappingnotify(XEvent *e)
 	XMappingEvent *ev = &e->xmapping;
 
 	XRefreshKeyboardMapping(ev);
-	if (ev->request == MappingKeyboard)
+	if (ev->request == MappingKeyboard || ev->request == MappingModifier)
 		grabkeys();
 }
 
@@ -1463,16 +1932,18 @@ maprequest(XEvent *e)
 void
 monocle(Monitor *m)
 {
-	unsigned int n = 0;
-	Client *c;
+	layoutapply(m, monoclerects);
+}
 
-	for (c = m->clients; c; c = c->next)
-		if (ISVISIBLE(c))
-			n++;
-	if (n > 0) /* override layout symbol */
-		snprintf(m->ltsymbol, sizeof m->ltsymbol, "[%d]", n);
-	for (c = nexttiled(m->clients); c; c = nexttiled(c->next))
-		resize(c, m->wx, m->wy, m->ww - 2 * c->bw, m->wh - 2 * c->bw, 0);
+void
+monoclerects(const LayoutMonitor *lm, const LayoutClient *lc, unsigned int n, LayoutRect *r, char *symbol)
+{
+	unsigned int i;
+
+	if (lm->nvisible > 0) /* override layout symbol */
+		snprintf(symbol, LTSYMBOLSIZE, "[%d]", lm->nvisible);
+	for (i = 0; i < n; i++)
+		r[i] = (LayoutRect){ lm->wx, lm->wy, lm->ww - 2 * lc[i].bw, lm->wh - 2 * lc[i].bw, RectPlaced };
 }
 
 void
@@ -1536,10 +2007,10 @@ movemouse(const Arg *arg)
 				ny = selmon->wy;
 			else if (abs((selmon->wy + selmon->wh) - (ny + HEIGHT(c))) < snap)
 				ny = selmon->wy + selmon->wh - HEIGHT(c);
-			if (!c->isfloating && selmon->lt[selmon->sellt]->arrange
+			if (!c->isfloating && ISTILED(selmon)
 			&& (abs(nx - c->x) > snap || abs(ny - c->y) > snap))
 				togglefloating(NULL);
-			if (!selmon->lt[selmon->sellt]->arrange || c->isfloating)
+			if (!ISTILED(selmon) || c->isfloating)
 				resize(c, nx, ny, c->w, c->h, 1);
 			break;
 		}
@@ -1580,6 +2051,47 @@ pop(Client *c)
 	arrange(c->mon);
 }
 
+void
+prefetch(Window w, Prefetch *pf)
+{
+	xcb_get_property_cookie_t ck[PropLast];
+	xcb_res_query_client_ids_cookie_t pidck;
+	xcb_generic_error_t *e;
+	int i;
+	const Atom atoms[PropLast] = {
+		[PropNetWMName] = netatom[NetWMName],
+		[PropWMName] = XA_WM_NAME,
+		[PropTransient] = XA_WM_TRANSIENT_FOR,
+		[PropClass] = XA_WM_CLASS,
+		[PropNetWMState] = netatom[NetWMState],
+		[PropNetWMWindowType] = netatom[NetWMWindowType],
+		[PropNormalHints] = XA_WM_NORMAL_HINTS,
+		[PropHints] = XA_WM_HINTS,
+	};
+	/* in 32 bit units, only the first atom of the state and type is used */
+	const uint32_t lens[PropLast] = {
+		[PropNetWMName] = 1024,
+		[PropWMName] = 1024,
+		[PropTransient] = 1,
+		[PropClass] = 1024,
+		[PropNetWMState] = 1,
+		[PropNetWMWindowType] = 1,
+		[PropNormalHints] = 18,
+		[PropHints] = 9,
+	};
+
+	/* send every request before waiting on the first reply */
+	pidck = winpidquery(w);
+	for (i = 0; i < PropLast; i++)
+		ck[i] = xcb_get_property(xcon, 0, w, atoms[i], XCB_GET_PROPERTY_TYPE_ANY, 0, lens[i]);
+	for (i = 0; i < PropLast; i++) {
+		e = NULL;
+		pf->prop[i] = xcb_get_property_reply(xcon, ck[i], &e);
+		free(e);
+	}
+	pf->pid = winpid(w, pidck);
+}
+
 void
 propertynotify(XEvent *e)
 {
@@ -1623,6 +2135,111 @@ quit(const Arg *arg)
 	running = 0;
 }
 
+void
+replyclass(xcb_get_property_reply_t *r, char *class, char *instance, size_t size)
+{
+	char *p;
+	int len, n;
+
+	strcpy(class, broken);
+	strcpy(instance, broken);
+	if (!(p = replyvalue(r, XA_STRING, 8, 1)))
+		return;
+	/* WM_CLASS holds the instance and the class, each NUL terminated */
+	len = xcb_get_property_value_length(r);
+	for (n = 0; n < len && p[n]; n++);
+	snprintf(instance, size, "%.*s", n, p);
+	if (n + 1 < len) {
+		p += n + 1;
+		len -= n + 1;
+		for (n = 0; n < len && p[n]; n++);
+		snprintf(class, size, "%.*s", n, p);
+	}
+}
+
+int
+replysizehints(xcb_get_property_reply_t *r, XSizeHints *size)
+{
+	uint32_t *v;
+
+	/* ICCCM 4.1.2.3, older clients only set the first 15 fields */
+	if (!(v = replyvalue(r, XA_WM_SIZE_HINTS, 32, 15)))
+		return 0;
+	memset(size, 0, sizeof(XSizeHints));
+	size->flags = v[0] & (USPosition|USSize|PAllHints|PBaseSize|PWinGravity);
+	size->x = (int32_t)v[1];
+	size->y = (int32_t)v[2];
+	size->width = (int32_t)v[3];
+	size->height = (int32_t)v[4];
+	size->min_width = (int32_t)v[5];
+	size->min_height = (int32_t)v[6];
+	size->max_width = (int32_t)v[7];
+	size->max_height = (int32_t)v[8];
+	size->width_inc = (int32_t)v[9];
+	size->height_inc = (int32_t)v[10];
+	size->min_aspect.x = (int32_t)v[11];
+	size->min_aspect.y = (int32_t)v[12];
+	size->max_aspect.x = (int32_t)v[13];
+	size->max_aspect.y = (int32_t)v[14];
+	if (xcb_get_property_value_length(r) >= 18 * 4) {
+		size->base_width = (int32_t)v[15];
+		size->base_height = (int32_t)v[16];
+		size->win_gravity = (int32_t)v[17];
+	} else
+		size->flags &= ~(PBaseSize|PWinGravity);
+	return 1;
+}
+
+int
+replytextprop(xcb_get_property_reply_t *r, char *text, unsigned int size)
+{
+	XTextProperty name;
+	int len;
+
+	text[0] = '\0';
+	if (!r || r->type == None || r->format != 8
+	|| !(len = xcb_get_property_value_length(r)))
+		return 0;
+	/* reply data is not NUL terminated, unlike what XGetTextProperty returns */
+	name.value = ecalloc(len + 1, 1);
+	memcpy(name.value, xcb_get_property_value(r), len);
+	name.encoding = r->type;
+	name.format = 8;
+	name.nitems = len;
+	decodetextprop(&name, text, size);
+	free(name.value);
+	return 1;
+}
+
+void *
+replyvalue(xcb_get_property_reply_t *r, Atom type, int format, int n)
+{
+	if (!r || r->type != type || r->format != format
+	|| xcb_get_property_value_length(r) < n * (format / 8))
+		return NULL;
+	return xcb_get_property_value(r);
+}
+
+int
+replywmhints(xcb_get_property_reply_t *r, XWMHints *wmh)
+{
+	uint32_t *v;
+
+	/* the window group was added later, accept hints without it */
+	if (!(v = replyvalue(r, XA_WM_HINTS, 32, 8)))
+		return 0;
+	wmh->flags = v[0];
+	wmh->input = v[1] != 0;
+	wmh->initial_state = (int32_t)v[2];
+	wmh->icon_pixmap = v[3];
+	wmh->icon_window = v[4];
+	wmh->icon_x = (int32_t)v[5];
+	wmh->icon_y = (int32_t)v[6];
+	wmh->icon_mask = v[7];
+	wmh->window_group = xcb_get_property_value_length(r) >= 9 * 4 ? v[8] : 0;
+	return 1;
+}
+
 Monitor *
 recttomon(int x, int y, int w, int h)
 {
@@ -1647,73 +2264,20 @@ resize(Client *c, int x, int y, int w, int h, int interact)
 void
 resizeclient(Client *c, int x, int y, int w, int h)
 {
-	int					lgappx	= gappx;
-	XWindowChanges		wc;
-	int					gapN, gapE, gapW;
-	int					edges	= 0;
-	int					margin;
-
-	if (c->mon->mw <= 1024 || c->mon->mh <= 1024) {
-		lgappx = 0;
-	}
-
-	margin = lgappx * 2;
-
-	/*
-		Clients are generally arranged relative to the client above them, so
-		include the entire gap to account for the one below it.
-	*/
-	gapN = lgappx;
-
-	gapE = lgappx / 2;
-	gapW = lgappx - gapE;
-
-
-	/*
-		Adjust gaps for any edge of a client that is next to the edge of the
-		monitor.
-	*/
-	if ((c->mon->mx + c->mon->mw) - (x + w) < margin) {
-		gapE = 0;
-		edges++;
-	}
-	if ((c->mon->my + c->mon->mh) - (y + h) < margin) {
-		edges++;
-	}
-
-	if ((x - c->mon->mx) < margin) {
-		gapW = 0;
-		edges++;
-	}
-	if ((y - c->mon->my) < margin) {
-		gapN = 0;
-		edges++;
-	}
-
-	if (c->isfloating || edges >= 4) {
-		gapN = gapE = gapW = 0;
-	} else {
-		/*
-			MNG Hack
+	applygaps(c->mon->mx, c->mon->my, c->mon->mw, c->mon->mh, c->isfloating, &x, &y, &w, &h);
+	ipc_state_mark_dirty();
+	c->oldx = c->x; c->x = x;
+	c->oldy = c->y; c->y = y;
+	c->oldw = c->w; c->w = w;
+	c->oldh = c->h; c->h = h;
 
-			I am using picom/compton to show a "shadow" on just the bottom edge
-			as if it was a 1px border. But, I need a place to show this so steal
-			1px from the gapN.
-
-			This is very hacky, but works for my usecase.
-		*/
-		h--;
+	if (configdepth) {
+		c->configpending = 1;
+		configqueued = 1;
+		return;
 	}
-
-	c->oldx = c->x; c->x = wc.x = x + gapW;
-	c->oldy = c->y; c->y = wc.y = y + gapN;
-	c->oldw = c->w; c->w = wc.width  = w - (gapW + gapE);
-	c->oldh = c->h; c->h = wc.height = h - (gapN);
-
-	wc.border_width = c->bw;
-	XConfigureWindow(dpy, c->win, CWX|CWY|CWWidth|CWHeight|CWBorderWidth, &wc);
-	configure(c);
-	XSync(dpy, False);
+	if (configurewindow(c))
+		XSync(dpy, False);
 }
 
 void
@@ -1754,11 +2318,11 @@ resizemouse(const Arg *arg)
 			if (c->mon->wx + nw >= selmon->wx && c->mon->wx + nw <= selmon->wx + selmon->ww
 			&& c->mon->wy + nh >= selmon->wy && c->mon->wy + nh <= selmon->wy + selmon->wh)
 			{
-				if (!c->isfloating && selmon->lt[selmon->sellt]->arrange
+				if (!c->isfloating && ISTILED(selmon)
 				&& (abs(nw - c->w) > snap || abs(nh - c->h) > snap))
 					togglefloating(NULL);
 			}
-			if (!selmon->lt[selmon->sellt]->arrange || c->isfloating)
+			if (!ISTILED(selmon) || c->isfloating)
 				resize(c, c->x, c->y, nw, nh, 1);
 			break;
 		}
@@ -1780,12 +2344,17 @@ restack(Monitor *m)
 	XEvent ev;
 	XWindowChanges wc;
 
+	if (arrangedepth) {
+		m->needrestack = 1;
+		return;
+	}
 	drawbar(m);
+	updateclientstacking();
 	if (!m->sel)
 		return;
-	if (m->sel->isfloating || !m->lt[m->sellt]->arrange)
+	if (m->sel->isfloating || !ISTILED(m))
 		XRaiseWindow(dpy, m->sel->win);
-	if (m->lt[m->sellt]->arrange) {
+	if (ISTILED(m)) {
 		wc.stack_mode = Below;
 		wc.sibling = m->barwin;
 		for (c = m->stack; c; c = c->snext)
@@ -1794,6 +2363,7 @@ restack(Monitor *m)
 				wc.sibling = c->win;
 			}
 	}
+	configureflush();
 	XSync(dpy, False);
 	while (XCheckMaskEvent(dpy, EnterWindowMask, &ev));
 }
@@ -1821,9 +2391,13 @@ run(void)
 					return;
 			} else if (event_fd == ipc_get_sock_fd()) {
 				ipc_handle_socket_epoll_event(events + i);
+#ifdef PROCCONN
+			} else if (event_fd == procconn_fd) {
+				procconnevent();
+#endif /* PROCCONN */
 			} else if (ipc_is_client_registered(event_fd)){
 				if (ipc_handle_client_epoll_event(events + i, mons, &lastselmon, selmon,
-							tags, LENGTH(tags), layouts, LENGTH(layouts)) < 0) {
+							tags, LENGTH(tags), layouts, LENGTH(layouts), &stats) < 0) {
 					fprintf(stderr, "Error handling IPC event on fd %d\n", event_fd);
 				}
 			} else {
@@ -1831,39 +2405,102 @@ run(void)
 						event_fd, events[i].data.ptr, events[i].data.u32,
 						events[i].data.u64);
 				fprintf(stderr, " with events %d\n", events[i].events);
-				return;
+				/* stale registration, don't wake up for it again */
+				epoll_ctl(epoll_fd, EPOLL_CTL_DEL, event_fd, NULL);
 			}
 		}
+		ipc_drop_pending();
 	}
 }
 
 void
 scan(void)
 {
-	unsigned int i, num;
-	Window d1, d2, *wins = NULL;
+	xcb_query_tree_reply_t *tree;
+	xcb_window_t *wins;
+	ScanWin *sc;
 	XWindowAttributes wa;
-
-	if (XQueryTree(dpy, root, &d1, &d2, &wins, &num)) {
+	struct timespec t0, t1, t2;
+	unsigned int i, num, pass, managed = 0;
+	char class[256], instance[256];
+	uint32_t *v;
+	int trans, iconic;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if (!(tree = xcb_query_tree_reply(xcon, xcb_query_tree(xcon, root), NULL)))
+		return;
+	num = xcb_query_tree_children_length(tree);
+	wins = xcb_query_tree_children(tree);
+	sc = ecalloc(num ? num : 1, sizeof(ScanWin));
+
+	/* send the requests for every window before waiting on the first reply */
+	for (i = 0; i < num; i++) {
+		sc[i].attrck = xcb_get_window_attributes(xcon, wins[i]);
+		sc[i].geomck = xcb_get_geometry(xcon, wins[i]);
+		sc[i].transck = xcb_get_property(xcon, 0, wins[i], XA_WM_TRANSIENT_FOR,
+			XA_WINDOW, 0, 1);
+		sc[i].stateck = xcb_get_property(xcon, 0, wins[i], wmatom[WMState],
+			wmatom[WMState], 0, 2);
+		if (usealtbar)
+			sc[i].classck = xcb_get_property(xcon, 0, wins[i], XA_WM_CLASS,
+				XA_STRING, 0, 1024);
+	}
+	for (i = 0; i < num; i++) {
+		sc[i].attr = xcb_get_window_attributes_reply(xcon, sc[i].attrck, NULL);
+		sc[i].geom = xcb_get_geometry_reply(xcon, sc[i].geomck, NULL);
+		sc[i].trans = xcb_get_property_reply(xcon, sc[i].transck, NULL);
+		sc[i].state = xcb_get_property_reply(xcon, sc[i].stateck, NULL);
+		if (usealtbar)
+			sc[i].class = xcb_get_property_reply(xcon, sc[i].classck, NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	/* the first pass skips transients so their parents are managed first */
+	for (pass = 0; pass < 2; pass++) {
 		for (i = 0; i < num; i++) {
-			if (!XGetWindowAttributes(dpy, wins[i], &wa)
-			|| wa.override_redirect || XGetTransientForHint(dpy, wins[i], &d1))
+			if (!sc[i].attr || !sc[i].geom)
 				continue;
-			if (usealtbar && wmclasscontains(wins[i], altbarclass, ""))
-				managealtbar(wins[i], &wa);
-			else if (wa.map_state == IsViewable || getstate(wins[i]) == IconicState)
-				manage(wins[i], &wa);
-		}
-		for (i = 0; i < num; i++) { /* now the transients */
-			if (!XGetWindowAttributes(dpy, wins[i], &wa))
+			trans = replyvalue(sc[i].trans, XA_WINDOW, 32, 1) != NULL;
+			if (trans != (pass == 1) || (pass == 0 && sc[i].attr->override_redirect))
 				continue;
-			if (XGetTransientForHint(dpy, wins[i], &d1)
-			&& (wa.map_state == IsViewable || getstate(wins[i]) == IconicState))
+			memset(&wa, 0, sizeof wa);
+			wa.x = sc[i].geom->x;
+			wa.y = sc[i].geom->y;
+			wa.width = sc[i].geom->width;
+			wa.height = sc[i].geom->height;
+			wa.border_width = sc[i].geom->border_width;
+			wa.depth = sc[i].geom->depth;
+			wa.map_state = sc[i].attr->map_state;
+			wa.override_redirect = sc[i].attr->override_redirect;
+			iconic = (v = replyvalue(sc[i].state, wmatom[WMState], 32, 1))
+				&& v[0] == IconicState;
+			if (pass == 0 && replyvalue(sc[i].class, XA_STRING, 8, 1)) {
+				replyclass(sc[i].class, class, instance, sizeof class);
+				if (strstr(class, altbarclass)) {
+					managealtbar(wins[i], &wa);
+					continue;
+				}
+			}
+			if (wa.map_state == IsViewable || iconic) {
 				manage(wins[i], &wa);
+				managed++;
+			}
 		}
-		if (wins)
-			XFree(wins);
 	}
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+	fprintf(stderr, "dwm: scan: %u windows queried in %.2f ms, %u managed in %.2f ms\n",
+		num, (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6,
+		managed, (t2.tv_sec - t1.tv_sec) * 1e3 + (t2.tv_nsec - t1.tv_nsec) / 1e6);
+
+	for (i = 0; i < num; i++) {
+		free(sc[i].attr);
+		free(sc[i].geom);
+		free(sc[i].trans);
+		free(sc[i].state);
+		free(sc[i].class);
+	}
+	free(sc);
+	free(tree);
 }
 
 void
@@ -1895,10 +2532,12 @@ sendmon(Client *c, Monitor *m)
 	if (c->mon == m)
 		return;
 	unfocus(c, 1);
+	tagcount(c, -1);
 	detach(c);
 	detachstack(c);
 	c->mon = m;
 	c->tags = m->tagset[m->seltags]; /* assign tags of target monitor */
+	tagcount(c, +1);
 	if( attachbelow )
 		attachBelow(c);
 	else
@@ -2013,7 +2652,7 @@ void setcfact(const Arg *arg) {
 
 	c = selmon->sel;
 
-	if(!arg || !c || !selmon->lt[selmon->sellt]->arrange)
+	if(!arg || !c || !ISTILED(selmon))
 		return;
 	f = arg->f + c->cfact;
 	if(arg->f == 0.0)
@@ -2042,7 +2681,7 @@ setmfact(const Arg *arg)
 {
 	float f;
 
-	if (!arg || !selmon->lt[selmon->sellt]->arrange)
+	if (!arg || !ISTILED(selmon))
 		return;
 	f = arg->f < 1.0 ? arg->f + selmon->mfact : arg->f - 1.0;
 	if (f < 0.05 || f > 0.95)
@@ -2094,6 +2733,7 @@ setup(void)
 	netatom[NetWMWindowTypeDock] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_DOCK", False);
 	netatom[NetWMWindowTypeDialog] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_DIALOG", False);
 	netatom[NetClientList] = XInternAtom(dpy, "_NET_CLIENT_LIST", False);
+	netatom[NetClientListStacking] = XInternAtom(dpy, "_NET_CLIENT_LIST_STACKING", False);
 	netatom[NetWMWindowsOpacity] = XInternAtom(dpy, "_NET_WM_WINDOW_OPACITY", False);
 	xatom[Manager] = XInternAtom(dpy, "MANAGER", False);
 	xatom[Xembed] = XInternAtom(dpy, "_XEMBED", False);
@@ -2122,6 +2762,7 @@ setup(void)
 	XChangeProperty(dpy, root, netatom[NetSupported], XA_ATOM, 32,
 		PropModeReplace, (unsigned char *) netatom, NetLast);
 	XDeleteProperty(dpy, root, netatom[NetClientList]);
+	XDeleteProperty(dpy, root, netatom[NetClientListStacking]);
 	/* select events */
 	wa.cursor = cursor[CurNormal]->cursor;
 	wa.event_mask = SubstructureRedirectMask|SubstructureNotifyMask
@@ -2159,9 +2800,14 @@ setupepoll(void)
 		exit(1);
 	}
 
-	if (ipc_init(ipcsockpath, epoll_fd, ipccommands, LENGTH(ipccommands)) < 0) {
+	if (ipc_init(ipcsockpath, epoll_fd, ipccommands, LENGTH(ipccommands),
+			ipcqueuemax, ipcqueuepolicy, arrangebegin, arrangeend) < 0) {
 		fputs("Failed to initialize IPC\n", stderr);
-	}
+	} else if (ipcstatename)
+		ipc_state_init(ipcstatename);
+#ifdef PROCCONN
+	setupprocconn();
+#endif /* PROCCONN */
 }
 
 void
@@ -2169,7 +2815,9 @@ seturgent(Client *c, int urg)
 {
 	XWMHints *wmh;
 
+	tagcount(c, -1);
 	c->isurgent = urg;
+	tagcount(c, +1);
 	if (!(wmh = XGetWMHints(dpy, c->win)))
 		return;
 	wmh->flags = urg ? (wmh->flags | XUrgencyHint) : (wmh->flags & ~XUrgencyHint);
@@ -2185,16 +2833,57 @@ showhide(Client *c)
 	if (ISVISIBLE(c)) {
 		/* show clients top down */
 		XMoveWindow(dpy, c->win, c->x, c->y);
-		if ((!c->mon->lt[c->mon->sellt]->arrange || c->isfloating) && !c->isfullscreen)
+		c->cfgx = c->x;
+		c->cfgy = c->y;
+		if ((!ISTILED(c->mon) || c->isfloating) && !c->isfullscreen)
 			resize(c, c->x, c->y, c->w, c->h, 0);
 		showhide(c->snext);
 	} else {
 		/* hide clients bottom up */
 		showhide(c->snext);
 		XMoveWindow(dpy, c->win, WIDTH(c) * -2, c->y);
+		c->cfgx = WIDTH(c) * -2;
+		c->cfgy = c->y;
 	}
 }
 
+/* Adjust a size to the size hints of a client, see ICCCM 4.1.2.3 */
+void
+sizehints(const LayoutClient *lc, int *w, int *h)
+{
+	int baseismin;
+
+	/* see last two sentences in ICCCM 4.1.2.3 */
+	baseismin = lc->basew == lc->minw && lc->baseh == lc->minh;
+	if (!baseismin) { /* temporarily remove base dimensions */
+		*w -= lc->basew;
+		*h -= lc->baseh;
+	}
+	/* adjust for aspect limits */
+	if (lc->mina > 0 && lc->maxa > 0) {
+		if (lc->maxa < (float)*w / *h)
+			*w = *h * lc->maxa + 0.5;
+		else if (lc->mina < (float)*h / *w)
+			*h = *w * lc->mina + 0.5;
+	}
+	if (baseismin) { /* increment calculation requires this */
+		*w -= lc->basew;
+		*h -= lc->baseh;
+	}
+	/* adjust for increment value */
+	if (lc->incw)
+		*w -= *w % lc->incw;
+	if (lc->inch)
+		*h -= *h % lc->inch;
+	/* restore base dimensions */
+	*w = MAX(*w + lc->basew, lc->minw);
+	*h = MAX(*h + lc->baseh, lc->minh);
+	if (lc->maxw)
+		*w = MIN(*w, lc->maxw);
+	if (lc->maxh)
+		*h = MIN(*h, lc->maxh);
+}
+
 void
 sigchld(int unused)
 {
@@ -2228,12 +2917,35 @@ void
 tag(const Arg *arg)
 {
 	if (selmon->sel && arg->ui & TAGMASK) {
+		tagcount(selmon->sel, -1);
 		selmon->sel->tags = arg->ui & TAGMASK;
+		tagcount(selmon->sel, +1);
 		focus(NULL);
 		arrange(selmon);
 	}
 }
 
+/* Call with -1 before changing the tags, monitor or urgency of a managed
+ * client and with +1 afterwards to keep the occupied and urgent tag masks of
+ * its monitor current. */
+void
+tagcount(Client *c, int delta)
+{
+	Monitor *m = c->mon;
+	unsigned int i;
+
+	ipc_state_mark_dirty();
+	for (i = 0; i < LENGTH(tags); i++) {
+		if (!(c->tags & 1 << i))
+			continue;
+		m->ntagged[i] += delta;
+		if (c->isurgent)
+			m->nurgent[i] += delta;
+		m->occ = m->ntagged[i] ? m->occ | 1 << i : m->occ & ~(1 << i);
+		m->urg = m->nurgent[i] ? m->urg | 1 << i : m->urg & ~(1 << i);
+	}
+}
+
 void
 tagmon(const Arg *arg)
 {
@@ -2245,36 +2957,44 @@ tagmon(const Arg *arg)
 void
 tile(Monitor *m)
 {
-	unsigned int i, n, h, mw, my, ty;
+	layoutapply(m, tilerects);
+}
+
+void
+tilerects(const LayoutMonitor *lm, const LayoutClient *lc, unsigned int n, LayoutRect *r, char *symbol)
+{
+	unsigned int i, h, mw, my, ty;
 	float mfacts = 0, sfacts = 0;
-	Client *c;
+	LayoutRect f;
 
-	for (n = 0, c = nexttiled(m->clients); c; c = nexttiled(c->next), n++) {
-		if (n < m->nmaster)
-			mfacts += c->cfact;
+	for (i = 0; i < n; i++) {
+		if (i < lm->nmaster)
+			mfacts += lc[i].cfact;
 		else
-			sfacts += c->cfact;
+			sfacts += lc[i].cfact;
 	}
 	if (n == 0)
 		return;
 
-	if (n > m->nmaster)
-		mw = m->nmaster ? m->ww * m->mfact : 0;
+	if (n > lm->nmaster)
+		mw = lm->nmaster ? lm->ww * lm->mfact : 0;
 	else
-		mw = m->ww;
-	for (i = my = ty = 0, c = nexttiled(m->clients); c; c = nexttiled(c->next), i++)
-		if (i < m->nmaster) {
-			h = (m->wh - my) * (c->cfact / mfacts);
-			resize(c, m->wx, m->wy + my, mw - (2*c->bw), h - (2*c->bw), 0);
-			if (my + HEIGHT(c) < m->wh)
-				my += HEIGHT(c);
-     mfacts -= c->cfact;
+		mw = lm->ww;
+	for (i = my = ty = 0; i < n; i++)
+		if (i < lm->nmaster) {
+			h = (lm->wh - my) * (lc[i].cfact / mfacts);
+			r[i] = (LayoutRect){ lm->wx, lm->wy + my, mw - (2*lc[i].bw), h - (2*lc[i].bw), RectPlaced };
+			f = layoutfit(lm, &lc[i], r[i]);
+			if (my + f.h + 2 * lc[i].bw < lm->wh)
+				my += f.h + 2 * lc[i].bw;
+			mfacts -= lc[i].cfact;
 		} else {
-			h = (m->wh - ty) * (c->cfact / sfacts);
-			resize(c, m->wx + mw, m->wy + ty, m->ww - mw - (2*c->bw), h - (2*c->bw), 0);
-			if (ty + HEIGHT(c) < m->wh)
-				ty += HEIGHT(c);
-     sfacts -= c->cfact;
+			h = (lm->wh - ty) * (lc[i].cfact / sfacts);
+			r[i] = (LayoutRect){ lm->wx + mw, lm->wy + ty, lm->ww - mw - (2*lc[i].bw), h - (2*lc[i].bw), RectPlaced };
+			f = layoutfit(lm, &lc[i], r[i]);
+			if (ty + f.h + 2 * lc[i].bw < lm->wh)
+				ty += f.h + 2 * lc[i].bw;
+			sfacts -= lc[i].cfact;
 		}
 }
 
@@ -2327,7 +3047,9 @@ toggletag(const Arg *arg)
 		return;
 	newtags = selmon->sel->tags ^ (arg->ui & TAGMASK);
 	if (newtags) {
+		tagcount(selmon->sel, -1);
 		selmon->sel->tags = newtags;
+		tagcount(selmon->sel, +1);
 		focus(NULL);
 		arrange(selmon);
 	}
@@ -2375,6 +3097,8 @@ unmanage(Client *c, int destroyed)
 
 	Client *s = swallowingclient(c->win);
 	if (s) {
+		winindexdel(&swallowindex, c->win);
+		pidcachedrop(s->swallowing->pid);
 		free(s->swallowing);
 		s->swallowing = NULL;
 		arrange(m);
@@ -2382,8 +3106,11 @@ unmanage(Client *c, int destroyed)
 		return;
 	}
 
+	tagcount(c, -1);
 	detach(c);
 	detachstack(c);
+	winindexdel(&clientindex, c->win);
+	pidcachedrop(c->pid);
 	if (!destroyed) {
 		wc.border_width = c->oldbw;
 		XGrabServer(dpy); /* avoid race conditions */
@@ -2475,13 +3202,45 @@ updateclientlist()
 {
 	Client *c;
 	Monitor *m;
+	unsigned int n = 0;
 
-	XDeleteProperty(dpy, root, netatom[NetClientList]);
+	clientlistreserve();
 	for (m = mons; m; m = m->next)
 		for (c = m->clients; c; c = c->next)
-			XChangeProperty(dpy, root, netatom[NetClientList],
-				XA_WINDOW, 32, PropModeAppend,
-				(unsigned char *) &(c->win), 1);
+			clientlist[n++] = c->win;
+	XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32,
+		PropModeReplace, (unsigned char *) clientlist, n);
+	updateclientstacking();
+}
+
+void
+updateclientstacking(void)
+{
+	Client *c;
+	Monitor *m;
+	Window t;
+	int i, j, n = 0;
+
+	clientlistreserve();
+	for (m = mons; m; m = m->next) {
+		/* restack() keeps floating clients above tiled ones, each in focus
+		 * order, collect them top down and reverse since the property
+		 * lists the bottom most window first */
+		i = n;
+		for (c = m->stack; c; c = c->snext)
+			if (c->isfloating || !ISTILED(m))
+				clientlist[n++] = c->win;
+		for (c = m->stack; c; c = c->snext)
+			if (!c->isfloating && ISTILED(m))
+				clientlist[n++] = c->win;
+		for (j = n - 1; i < j; i++, j--) {
+			t = clientlist[i];
+			clientlist[i] = clientlist[j];
+			clientlist[j] = t;
+		}
+	}
+	XChangeProperty(dpy, root, netatom[NetClientListStacking], XA_WINDOW, 32,
+		PropModeReplace, (unsigned char *) clientlist, n);
 }
 
 int
@@ -2533,7 +3292,9 @@ updategeom(void)
 					dirty = 1;
 					m->clients = c->next;
 					detachstack(c);
+					tagcount(c, -1);
 					c->mon = mons;
+					tagcount(c, +1);
 					if( attachbelow )
 						attachBelow(c);
 					else
@@ -2561,6 +3322,7 @@ updategeom(void)
 	if (dirty) {
 		selmon = mons;
 		selmon = wintomon(root);
+		ipc_state_mark_dirty();
 	}
 	return dirty;
 }
@@ -2590,6 +3352,14 @@ updatesizehints(Client *c)
 	if (!XGetWMNormalHints(dpy, c->win, &size, &msize))
 		/* size is uninitialized, ensure that size.flags aren't used */
 		size.flags = PSize;
+	setsizehints(c, &size);
+}
+
+void
+setsizehints(Client *c, XSizeHints *hints)
+{
+	XSizeHints size = *hints;
+
 	if (size.flags & PBaseSize) {
 		c->basew = size.base_width;
 		c->baseh = size.base_height;
@@ -2622,6 +3392,7 @@ updatesizehints(Client *c)
 	} else
 		c->maxa = c->mina = 0.0;
 	c->isfixed = (c->maxw && c->maxh && c->maxw == c->minw && c->maxh == c->minh);
+	ipc_state_mark_dirty();
 }
 
 void
@@ -2642,6 +3413,8 @@ updatetitle(Client *c)
 		gettextprop(c->win, XA_WM_NAME, c->name, sizeof c->name);
 	if (c->name[0] == '\0') /* hack to mark broken clients */
 		strcpy(c->name, broken);
+	if (strcmp(oldname, c->name) != 0)
+		ipc_state_mark_dirty();
 
 	for (Monitor *m = mons; m; m = m->next) {
 		if (m->sel == c && strcmp(oldname, c->name) != 0)
@@ -2652,9 +3425,13 @@ updatetitle(Client *c)
 void
 updatewindowtype(Client *c)
 {
-	Atom state = getatomprop(c, netatom[NetWMState]);
-	Atom wtype = getatomprop(c, netatom[NetWMWindowType]);
+	setwindowtype(c, getatomprop(c, netatom[NetWMState]),
+		getatomprop(c, netatom[NetWMWindowType]));
+}
 
+void
+setwindowtype(Client *c, Atom state, Atom wtype)
+{
 	if (state == netatom[NetWMFullscreen])
 		setfullscreen(c, 1);
 	if (wtype == netatom[NetWMWindowTypeDialog])
@@ -2667,19 +3444,27 @@ updatewmhints(Client *c)
 	XWMHints *wmh;
 
 	if ((wmh = XGetWMHints(dpy, c->win))) {
-		if (c == selmon->sel && wmh->flags & XUrgencyHint) {
-			wmh->flags &= ~XUrgencyHint;
-			XSetWMHints(dpy, c->win, wmh);
-		} else
-			c->isurgent = (wmh->flags & XUrgencyHint) ? 1 : 0;
-		if (wmh->flags & InputHint)
-			c->neverfocus = !wmh->input;
-		else
-			c->neverfocus = 0;
+		tagcount(c, -1);
+		setwmhints(c, wmh);
+		tagcount(c, +1);
 		XFree(wmh);
 	}
 }
 
+void
+setwmhints(Client *c, XWMHints *wmh)
+{
+	if (c == selmon->sel && wmh->flags & XUrgencyHint) {
+		wmh->flags &= ~XUrgencyHint;
+		XSetWMHints(dpy, c->win, wmh);
+	} else
+		c->isurgent = (wmh->flags & XUrgencyHint) ? 1 : 0;
+	if (wmh->flags & InputHint)
+		c->neverfocus = !wmh->input;
+	else
+		c->neverfocus = 0;
+}
+
 void
 view(const Arg *arg)
 {
@@ -2692,21 +3477,36 @@ view(const Arg *arg)
 	arrange(selmon);
 }
 
-pid_t
-winpid(Window w)
+/* The pid lookup is split in two so that manage() can pipeline the request
+ * with its property requests. winpid() must be given the cookie returned by
+ * winpidquery() for the same window. */
+xcb_res_query_client_ids_cookie_t
+winpidquery(Window w)
 {
-
-	pid_t result = 0;
+	xcb_res_query_client_ids_cookie_t c = {0};
 
 #ifdef __linux__
 	xcb_res_client_id_spec_t spec = {0};
 	spec.client = w;
 	spec.mask = XCB_RES_CLIENT_ID_MASK_LOCAL_CLIENT_PID;
 
+	c = xcb_res_query_client_ids(xcon, 1, &spec);
+#endif /* __linux__ */
+	return c;
+}
+
+pid_t
+winpid(Window w, xcb_res_query_client_ids_cookie_t c)
+{
+
+	pid_t result = 0;
+
+#ifdef __linux__
+	xcb_res_client_id_spec_t spec;
 	xcb_generic_error_t *e = NULL;
-	xcb_res_query_client_ids_cookie_t c = xcb_res_query_client_ids(xcon, 1, &spec);
 	xcb_res_query_client_ids_reply_t *r = xcb_res_query_client_ids_reply(xcon, c, &e);
 
+	free(e);
 	if (!r)
 		return (pid_t)0;
 
@@ -2749,17 +3549,38 @@ pid_t
 getparentprocess(pid_t p)
 {
 	unsigned int v = 0;
+	PidSlot *slot = NULL;
+
+	if (p <= 0)
+		return 0;
+#ifdef PROCCONN
+	/* only the proc connector notices intermediate processes exiting,
+	 * children being reparented and pids being reused, without it every
+	 * lookup goes to /proc */
+	if (procconn_fd >= 0) {
+		slot = &pidcache[p % LENGTH(pidcache)];
+		if (slot->pid == p)
+			return slot->ppid;
+	}
+#endif /* PROCCONN */
 
 #ifdef __linux__
-	FILE *f;
-	char buf[256];
+	int fd;
+	ssize_t n;
+	char buf[512], *e;
 	snprintf(buf, sizeof(buf) - 1, "/proc/%u/stat", (unsigned)p);
 
-	if (!(f = fopen(buf, "r")))
+	if ((fd = open(buf, O_RDONLY | O_CLOEXEC)) < 0)
 		return 0;
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return 0;
+	buf[n] = '\0';
 
-	fscanf(f, "%*u %*s %*c %u", &v);
-	fclose(f);
+	/* the command name may contain spaces and parens, skip past the last ')' */
+	if (!(e = strrchr(buf, ')')) || sscanf(e + 1, " %*c %u", &v) != 1)
+		return 0;
 #endif /* __linux__*/
 
 #ifdef __OpenBSD__
@@ -2775,9 +3596,117 @@ getparentprocess(pid_t p)
 	v = kp->p_ppid;
 #endif /* __OpenBSD__ */
 
+	if (slot) {
+		slot->pid = p;
+		slot->ppid = (pid_t)v;
+	}
 	return (pid_t)v;
 }
 
+void
+pidcachedrop(pid_t p)
+{
+	PidSlot *slot;
+
+	if (p <= 0)
+		return;
+	slot = &pidcache[p % LENGTH(pidcache)];
+	if (slot->pid == p)
+		slot->pid = slot->ppid = 0;
+}
+
+#ifdef PROCCONN
+void
+procconnevent(void)
+{
+	char buf[4096] __attribute__((aligned(NLMSG_ALIGNTO)));
+	struct nlmsghdr *nh;
+	struct cn_msg *cn;
+	struct proc_event *ev;
+	ssize_t n;
+	size_t i;
+
+	for (;;) {
+		if ((n = recv(procconn_fd, buf, sizeof(buf), 0)) < 0 && errno == ENOBUFS) {
+			/* the socket overran and events were lost, go back to /proc
+			 * until the cache has been filled again */
+			memset(pidcache, 0, sizeof pidcache);
+			continue;
+		}
+		if (n <= 0)
+			break;
+		for (nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, n); nh = NLMSG_NEXT(nh, n)) {
+			if (nh->nlmsg_type == NLMSG_NOOP || nh->nlmsg_type == NLMSG_ERROR)
+				continue;
+			cn = NLMSG_DATA(nh);
+			ev = (struct proc_event *)cn->data;
+			switch (ev->what) {
+			case PROC_EVENT_FORK:
+				if (ev->event_data.fork.child_pid != ev->event_data.fork.child_tgid)
+					break; /* new thread */
+				pidcache[ev->event_data.fork.child_tgid % LENGTH(pidcache)] = (PidSlot){
+					ev->event_data.fork.child_tgid, ev->event_data.fork.parent_tgid };
+				break;
+			case PROC_EVENT_EXIT:
+				if (ev->event_data.exit.process_pid != ev->event_data.exit.process_tgid)
+					break;
+				/* its children are reparented, forget where they came from */
+				for (i = 0; i < LENGTH(pidcache); i++)
+					if (pidcache[i].ppid == ev->event_data.exit.process_tgid)
+						pidcache[i].pid = pidcache[i].ppid = 0;
+				pidcachedrop(ev->event_data.exit.process_tgid);
+				break;
+			default:
+				break;
+			}
+		}
+	}
+}
+
+void
+setupprocconn(void)
+{
+	struct sockaddr_nl addr;
+	struct epoll_event ev;
+	char buf[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op))]
+		__attribute__((aligned(NLMSG_ALIGNTO)));
+	struct nlmsghdr *nh = (struct nlmsghdr *)buf;
+	struct cn_msg *cn = NLMSG_DATA(nh);
+
+	procconn_fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+		NETLINK_CONNECTOR);
+	if (procconn_fd < 0)
+		return;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = CN_IDX_PROC;
+	addr.nl_pid = getpid();
+
+	memset(buf, 0, sizeof(buf));
+	nh->nlmsg_len = sizeof(buf);
+	nh->nlmsg_type = NLMSG_DONE;
+	nh->nlmsg_pid = getpid();
+	cn->id.idx = CN_IDX_PROC;
+	cn->id.val = CN_VAL_PROC;
+	cn->len = sizeof(enum proc_cn_mcast_op);
+	*(enum proc_cn_mcast_op *)cn->data = PROC_CN_MCAST_LISTEN;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = procconn_fd;
+
+	/* listening usually needs CAP_NET_ADMIN, fall back to the plain cache */
+	if (bind(procconn_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+	|| send(procconn_fd, buf, sizeof(buf), 0) < 0
+	|| epoll_ctl(epoll_fd, EPOLL_CTL_ADD, procconn_fd, &ev) < 0) {
+		fputs("dwm: proc connector unavailable, polling /proc instead\n", stderr);
+		close(procconn_fd);
+		procconn_fd = -1;
+	}
+}
+#endif /* PROCCONN */
+
 int
 isdescprocess(pid_t p, pid_t c)
 {
@@ -2809,30 +3738,126 @@ termforwin(const Client *w)
 Client *
 swallowingclient(Window w)
 {
-	Client *c;
+	Client *c = winindexget(&swallowindex, w);
+#ifdef WINHASH_DEBUG
+	Client *l;
 	Monitor *m;
 
-	for (m = mons; m; m = m->next) {
-		for (c = m->clients; c; c = c->next) {
-			if (c->swallowing && c->swallowing->win == w)
-				return c;
+	for (l = NULL, m = mons; m && !l; m = m->next)
+		for (l = m->clients; l && !(l->swallowing && l->swallowing->win == w); l = l->next);
+	if (l != c) {
+		fprintf(stderr, "dwm: swallow index mismatch for 0x%lx: %p, expected %p\n",
+			w, (void *)c, (void *)l);
+		c = l;
+	}
+#endif /* WINHASH_DEBUG */
+	return c;
+}
+
+static unsigned int
+winhash(Window w)
+{
+	/* XIDs share their high bits per X client, so mix them into the low bits */
+	return (unsigned int)((w ^ (w >> 16)) * 2654435761UL);
+}
+
+void
+winindexadd(WinIndex *ix, Window w, Client *c)
+{
+	unsigned int i, mask;
+	WinSlot *dead = NULL;
+
+	if ((ix->used + ix->dead + 1) * 4 > ix->size * 3)
+		winindexresize(ix, ix->used * 4 > ix->size ? ix->size * 2 : ix->size);
+	mask = ix->size - 1;
+	for (i = winhash(w) & mask; ix->slots[i].win; i = (i + 1) & mask) {
+		if (ix->slots[i].win == w) {
+			if (!ix->slots[i].c) {
+				ix->dead--;
+				ix->used++;
+			}
+			ix->slots[i].c = c;
+			return;
 		}
+		if (!ix->slots[i].c && !dead)
+			dead = &ix->slots[i];
+	}
+	if (dead) {
+		ix->dead--;
+		dead->win = w;
+		dead->c = c;
+	} else {
+		ix->slots[i].win = w;
+		ix->slots[i].c = c;
 	}
+	ix->used++;
+}
+
+void
+winindexdel(WinIndex *ix, Window w)
+{
+	unsigned int i, mask;
+
+	if (!ix->size)
+		return;
+	mask = ix->size - 1;
+	for (i = winhash(w) & mask; ix->slots[i].win; i = (i + 1) & mask)
+		if (ix->slots[i].win == w) {
+			if (ix->slots[i].c) {
+				ix->slots[i].c = NULL;
+				ix->used--;
+				ix->dead++;
+			}
+			return;
+		}
+}
+
+Client *
+winindexget(WinIndex *ix, Window w)
+{
+	unsigned int i, mask;
 
+	if (!ix->size || !w)
+		return NULL;
+	mask = ix->size - 1;
+	for (i = winhash(w) & mask; ix->slots[i].win; i = (i + 1) & mask)
+		if (ix->slots[i].win == w)
+			return ix->slots[i].c;
 	return NULL;
 }
 
+void
+winindexresize(WinIndex *ix, unsigned int size)
+{
+	WinSlot *old = ix->slots;
+	unsigned int i, oldsz = ix->size;
+
+	ix->size = MAX(size, 64);
+	ix->slots = ecalloc(ix->size, sizeof(WinSlot));
+	ix->used = ix->dead = 0;
+	for (i = 0; i < oldsz; i++)
+		if (old[i].c)
+			winindexadd(ix, old[i].win, old[i].c);
+	free(old);
+}
+
 Client *
 wintoclient(Window w)
 {
-	Client *c;
+	Client *c = winindexget(&clientindex, w);
+#ifdef WINHASH_DEBUG
+	Client *l;
 	Monitor *m;
 
-	for (m = mons; m; m = m->next)
-		for (c = m->clients; c; c = c->next)
-			if (c->win == w)
-				return c;
-	return NULL;
+	for (l = NULL, m = mons; m && !l; m = m->next)
+		for (l = m->clients; l && l->win != w; l = l->next);
+	if (l != c) {
+		fprintf(stderr, "dwm: window index mismatch for 0x%lx: %p, expected %p\n",
+			w, (void *)c, (void *)l);
+		c = l;
+	}
+#endif /* WINHASH_DEBUG */
+	return c;
 }
 
 Monitor *
@@ -2952,7 +3977,7 @@ zoom(const Arg *arg)
 {
 	Client *c = selmon->sel;
 
-	if (!selmon->lt[selmon->sellt]->arrange
+	if (!ISTILED(selmon)
 	|| (selmon->sel && selmon->sel->isfloating))
 		return;
 	if (c == nexttiled(selmon->clients))
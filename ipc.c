@@ -4,11 +4,15 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/epoll.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 #include <yajl/yajl_gen.h>
 #include <yajl/yajl_tree.h>
@@ -19,13 +23,68 @@
 static struct sockaddr_un sockaddr;
 static struct epoll_event sock_epoll_event;
 static IPCClientList ipc_clients = NULL;
+// Connected clients indexed by file descriptor, see ipc_get_client()
+static IPCClient **ipc_fdtab = NULL;
+static int ipc_fdtab_len = 0;
+// Union of the subscriptions of all connected clients, per encoding
+static int ipc_subscriptions[IPC_ENCODING_LAST];
+// Reused for every reply and event, see ipc_gen_begin()
+static yajl_gen ipc_gen = NULL;
 static int epoll_fd = -1;
 static int sock_fd = -1;
 static IPCCommand *ipc_commands;
 static unsigned int ipc_commands_len;
+static uint32_t ipc_queue_max;
+static IPCQueuePolicy ipc_queue_policy;
+static void (*ipc_batch_begin)(void);
+static void (*ipc_batch_end)(void);
+// Shared memory state snapshot, see ipc_state_init()
+static const char *ipc_state_name = NULL;
+static int ipc_state_fd = -1;
+static IPCStateHeader *ipc_state = NULL;
+// The next snapshot is built here and only published if it differs
+static char *ipc_state_buf = NULL;
+static size_t ipc_state_buf_size = 0;
+// Set by ipc_state_mark_dirty(), the snapshot is only rebuilt when set
+static int ipc_state_dirty = 1;
+// Bumped whenever a monitor or client changed, see ipc_update_generations().
+// Seeded from the clock by ipc_init so generations of an earlier dwm are older.
+static unsigned long ipc_generation = 0;
+// Seed shift, an earlier dwm would need more generations than this many per
+// second of uptime to catch up with the seed
+#define IPC_GENERATION_SHIFT (sizeof(unsigned long) > 4 ? 20 : 0)
+static uint64_t ipc_mons_hash = 0;
+// FNV-1a, fingerprints of what get_monitors reports
+#define IPC_HASH_INIT 0xcbf29ce484222325ULL
 // Max size is 1 MB
 static const uint32_t MAX_MESSAGE_SIZE = 1000000;
 static const int IPC_SOCKET_BACKLOG = 5;
+// Most queued messages handed to a single writev() call
+#define IPC_WRITEV_MAX 16
+
+/**
+ * Make room for file descriptor fd in ipc_fdtab, growing it to the next power
+ * of two that covers fd. New slots are cleared.
+ *
+ * Returns 0 on success, -1 if memory could not be allocated.
+ */
+static int
+ipc_fdtab_reserve(int fd)
+{
+  if (fd < ipc_fdtab_len) return 0;
+
+  int len = ipc_fdtab_len ? ipc_fdtab_len : 16;
+  while (len <= fd) len *= 2;
+
+  IPCClient **tab = realloc(ipc_fdtab, len * sizeof(IPCClient *));
+  if (tab == NULL) return -1;
+
+  memset(tab + ipc_fdtab_len, 0, (len - ipc_fdtab_len) * sizeof(IPCClient *));
+  ipc_fdtab = tab;
+  ipc_fdtab_len = len;
+
+  return 0;
+}
 
 /**
  * Create IPC socket at specified path and return file descriptor to socket.
@@ -83,151 +142,235 @@ ipc_create_socket(const char *filename)
 }
 
 /**
- * Internal function used to receive IPC messages from a given file descriptor.
+ * Internal function used to receive IPC messages from a client. It reads only
+ * what is available without blocking and keeps the partial message in the
+ * client, so a client that stalls halfway through a message can't stall dwm.
+ * Exactly the bytes of one message are read, anything after it stays in the
+ * socket for the next wakeup.
  *
- * Returns -1 on error reading (could be EAGAIN or EINTR)
- * Returns -2 if EOF before header could be read
+ * Returns 1 if a complete message is in c->recv_type, c->recv_size and
+ *   c->recv_buf
+ * Returns 0 if the message is not complete yet
+ * Returns -1 on error reading, errno will carry over from read() call
+ * Returns -2 on EOF in the middle of or before a message
  * Returns -3 if invalid IPC header
  * Returns -4 if message length exceeds MAX_MESSAGE_SIZE
  */
 static int
-ipc_recv_message(int fd, uint8_t *msg_type, uint32_t *reply_size,
-                 uint8_t **reply)
+ipc_recv_message(IPCClient *c)
 {
-  uint32_t read_bytes = 0;
-  const int32_t to_read = sizeof(dwm_ipc_header_t);
-  char header[to_read];
-  char *walk = header;
+  while (1) {
+    uint8_t *dst;
+    uint32_t want;
 
-  // Try to read header
-  while (read_bytes < to_read) {
-    const ssize_t n = read(fd, header + read_bytes, to_read - read_bytes);
+    if (c->recv_state == IPC_RECV_HEADER) {
+      dst = c->recv_header;
+      want = IPC_HEADER_SIZE;
+    } else {
+      dst = (uint8_t *)c->recv_buf;
+      want = c->recv_size;
+    }
 
-    if (n == 0) {
-      if (read_bytes == 0) {
-        fprintf(stderr, "Unexpectedly reached EOF while reading header.");
+    while (c->recv_len < want) {
+      const ssize_t n = read(c->fd, dst + c->recv_len, want - c->recv_len);
+
+      if (n == 0) {
+        fprintf(stderr, "Unexpectedly reached EOF while reading %s. ",
+                c->recv_state == IPC_RECV_HEADER ? "header" : "payload");
         fprintf(stderr,
                 "Read %" PRIu32 " bytes, expected %" PRIu32 " total bytes.\n",
-                read_bytes, to_read);
+                c->recv_len, want);
         return -2;
-      } else {
-        fprintf(stderr, "Unexpectedly reached EOF while reading header.");
-        fprintf(stderr,
-                "Read %" PRIu32 " bytes, expected %" PRIu32 " total bytes.\n",
-                read_bytes, to_read);
-        return -3;
+      } else if (n == -1) {
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        // errno will still be set
+        return -1;
       }
-    } else if (n == -1) {
-      // errno will still be set
-      return -1;
+
+      c->recv_len += n;
     }
 
-    read_bytes += n;
-  }
+    if (c->recv_state == IPC_RECV_PAYLOAD) return 1;
 
-  // Check if magic string in header matches
-  if (memcmp(walk, IPC_MAGIC, IPC_MAGIC_LEN) != 0) {
-    fprintf(stderr, "Invalid magic string. Got '%.*s', expected '%s'\n",
-            IPC_MAGIC_LEN, walk, IPC_MAGIC);
-    return -3;
-  }
+    // Header complete, check if magic string matches
+    dwm_ipc_header_t header;
+    memcpy(&header, c->recv_header, IPC_HEADER_SIZE);
 
-  walk += IPC_MAGIC_LEN;
+    if (memcmp(header.magic, IPC_MAGIC, IPC_MAGIC_LEN) != 0) {
+      fprintf(stderr, "Invalid magic string. Got '%.*s', expected '%s'\n",
+              IPC_MAGIC_LEN, header.magic, IPC_MAGIC);
+      return -3;
+    }
 
-  // Extract reply size
-  memcpy(reply_size, walk, sizeof(uint32_t));
-  walk += sizeof(uint32_t);
+    if (header.size > MAX_MESSAGE_SIZE) {
+      fprintf(stderr, "Message too long: %" PRIu32 " bytes. ", header.size);
+      fprintf(stderr, "Maximum message size is: %d\n", MAX_MESSAGE_SIZE);
+      return -4;
+    }
 
-  if (*reply_size > MAX_MESSAGE_SIZE) {
-    fprintf(stderr, "Message too long: %" PRIu32 " bytes. ", *reply_size);
-    fprintf(stderr, "Maximum message size is: %d\n", MAX_MESSAGE_SIZE);
-    return -4;
+    c->recv_type = header.type;
+    c->recv_size = header.size;
+    c->recv_len = 0;
+    c->recv_state = IPC_RECV_PAYLOAD;
+    if (c->recv_size == 0) return 1;
+    c->recv_buf = malloc(c->recv_size);
   }
+}
 
-  // Extract message type
-  memcpy(msg_type, walk, sizeof(uint8_t));
-  walk += sizeof(uint8_t);
+/**
+ * Get the shared yajl handle, allocating it on first use, and configure it for
+ * the specified encoding. Every message built with it must be finished with
+ * ipc_gen_end().
+ */
+static yajl_gen
+ipc_gen_begin(IPCEncoding encoding)
+{
+  if (ipc_gen == NULL) ipc_gen = yajl_gen_alloc(NULL);
+  yajl_gen_config(ipc_gen, yajl_gen_beautify, encoding == IPC_ENCODING_PRETTY);
+  return ipc_gen;
+}
 
-  if (*reply_size > 0)
-    (*reply) = malloc(*reply_size);
-  else
-    return 0;
+/**
+ * Empty the buffer of the shared yajl handle so it can build the next message
+ */
+static void
+ipc_gen_end(yajl_gen gen)
+{
+  yajl_gen_clear(gen);
+  yajl_gen_reset(gen, NULL);
+}
 
-  read_bytes = 0;
-  while (read_bytes < *reply_size) {
-    const ssize_t n = read(fd, *reply + read_bytes, *reply_size - read_bytes);
-
-    if (n == 0) {
-      fprintf(stderr, "Unexpectedly reached EOF while reading payload.");
-      fprintf(stderr, "Read %" PRIu32 " bytes, expected %" PRIu32 " bytes.\n",
-              read_bytes, *reply_size);
-      free(*reply);
-      return -2;
-    } else if (n == -1) {
-      // TODO: Should we return and wait for another epoll event?
-      // This would require saving the partial read in some way.
-      if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) continue;
-
-      free(*reply);
-      return -1;
-    }
+/**
+ * Returns 1 if the client wants an event about monitor mon_num, -1 if none,
+ * that changed the specified IPCEventField, 0 otherwise
+ */
+static int
+ipc_event_matches(const IPCClient *c, IPCEvent event, int mon_num,
+                  uint32_t fields)
+{
+  return !c->dropping && (c->subscriptions & event) &&
+         (mon_num < 0 || c->monitor < 0 || c->monitor == mon_num) &&
+         (c->fields & fields);
+}
 
-    read_bytes += n;
-  }
+/**
+ * Returns 1 if any client using the encoding wants the event, 0 otherwise.
+ * Events nobody wants are never serialized.
+ */
+static int
+ipc_event_wanted(IPCEvent event, int mon_num, uint32_t fields,
+                 IPCEncoding encoding)
+{
+  if (!(ipc_subscriptions[encoding] & event)) return 0;
+
+  for (IPCClient *c = ipc_clients; c; c = c->next)
+    if (c->encoding == encoding && ipc_event_matches(c, event, mon_num, fields))
+      return 1;
 
   return 0;
 }
 
 /**
- * Internal function used to write a buffer to a file descriptor
+ * Initialization for generic event message in the specified encoding.
  *
- * Returns number of bytes written if successful write
- * Returns 0 if no bytes were written due to EAGAIN or EWOULDBLOCK
- * Returns -1 on unknown error trying to write, errno will carry over from
- *   write() call
+ * Returns the yajl handle to build the event with
+ * Returns NULL if no client using that encoding wants the event
  */
-static ssize_t
-ipc_write_message(int fd, const void *buf, size_t count)
+static yajl_gen
+ipc_event_init_message(IPCEvent event, int mon_num, uint32_t fields,
+                       IPCEncoding encoding)
 {
-  size_t written = 0;
-
-  while (written < count) {
-    const ssize_t n = write(fd, (uint8_t *)buf + written, count - written);
+  if (!ipc_event_wanted(event, mon_num, fields, encoding)) return NULL;
+  return ipc_gen_begin(encoding);
+}
 
-    if (n == -1) {
-      if (errno == EAGAIN || errno == EWOULDBLOCK)
-        return written;
-      else if (errno == EINTR)
-        continue;
-      else
-        return n;
-    }
+/**
+ * Queue an event on a subscriber. If the events the client hasn't read yet
+ * would exceed ipc_queue_max, the queue policy decides what to give up. With
+ * IPC_QUEUE_COALESCE the cap is soft: at most one event per type and monitor
+ * stays queued, so the queue can't grow past that.
+ *
+ * Returns 0 if the event was queued or dropped
+ * Returns -1 if the client is being disconnected. The client is only marked
+ * here and stays allocated until ipc_drop_pending, so an event for its fd later
+ * in the same epoll batch still finds it.
+ */
+static int
+ipc_queue_event(IPCClient *c, IPCMessage *msg)
+{
+  if (c->dropping) return -1;
 
-    written += n;
-    DEBUG("Wrote %zu/%zu to client at fd %d\n", written, count, fd);
+  if (c->queue_bytes + msg->size <= ipc_queue_max) {
+    ipc_queue_message(c, msg);
+    return 0;
   }
 
-  return written;
+  switch (ipc_queue_policy) {
+  case IPC_QUEUE_DISCONNECT:
+    fprintf(stderr, "IPC client at fd %d stopped reading, dropping it\n",
+            c->fd);
+    c->dropping = 1;
+    ipc_client_queue_clear(c);
+    return -1;
+  case IPC_QUEUE_COALESCE:
+    // Only the latest state per event type and monitor matters to the client
+    for (unsigned int i = c->queue_len; i-- > 0;) {
+      IPCQueueEntry *e = ipc_client_queue_at(c, i);
+      if (e->offset == 0 && e->msg->event == msg->event &&
+          e->msg->mon == msg->mon) {
+        ipc_client_queue_remove(c, i);
+        c->events_dropped++;
+      }
+    }
+    ipc_queue_message(c, msg);
+    return 0;
+  case IPC_QUEUE_DROP_OLDEST:
+  default:
+    // Replies and a partially written message must stay
+    for (unsigned int i = 0;
+         i < c->queue_len && c->queue_bytes + msg->size > ipc_queue_max;) {
+      IPCQueueEntry *e = ipc_client_queue_at(c, i);
+      if (e->offset == 0 && e->msg->event) {
+        ipc_client_queue_remove(c, i);
+        c->events_dropped++;
+      } else
+        i++;
+    }
+    if (c->queue_bytes + msg->size > ipc_queue_max)
+      c->events_dropped++;
+    else
+      ipc_queue_message(c, msg);
+    return 0;
+  }
 }
 
 /**
- * Initialization for generic event message. This is used to allocate the yajl
- * handle, set yajl options, and in the future any other initialization that
- * should occur for event messages.
+ * Queue an event message that changed the specified IPCEventField on every
+ * client using the specified encoding that wants it. Every subscriber queues
+ * a reference to the same message.
  */
 static void
-ipc_event_init_message(yajl_gen *gen)
+ipc_event_queue(IPCMessage *msg, uint32_t fields, IPCEncoding encoding)
 {
-  *gen = yajl_gen_alloc(NULL);
-  yajl_gen_config(*gen, yajl_gen_beautify, 1);
+  for (IPCClient *c = ipc_clients; c; c = c->next) {
+    if (c->encoding == encoding &&
+        ipc_event_matches(c, msg->event, msg->mon, fields)) {
+      DEBUG("Sending selected client change event to fd %d\n", c->fd);
+      ipc_queue_event(c, msg);
+    }
+  }
 }
 
 /**
- * Prepares buffers of IPC subscribers of specified event using buffer from yajl
- * handle.
+ * Prepares buffers of IPC subscribers of specified event that use the
+ * specified encoding using buffer from yajl handle. mon_num is the monitor the
+ * event is about, -1 if none, and tells events apart when coalescing. fields
+ * are the IPCEventField the event changed.
  */
 static void
-ipc_event_prepare_send_message(yajl_gen gen, IPCEvent event)
+ipc_event_prepare_send_message(yajl_gen gen, IPCEvent event, int mon_num,
+                               uint32_t fields, IPCEncoding encoding)
 {
   const unsigned char *buffer;
   size_t len = 0;
@@ -235,27 +378,68 @@ ipc_event_prepare_send_message(yajl_gen gen, IPCEvent event)
   yajl_gen_get_buf(gen, &buffer, &len);
   len++;  // For null char
 
-  for (IPCClient *c = ipc_clients; c; c = c->next) {
-    if (c->subscriptions & event) {
-      DEBUG("Sending selected client change event to fd %d\n", c->fd);
-      ipc_prepare_send_message(c, IPC_TYPE_EVENT, len, (char *)buffer);
-    }
-  }
+  IPCMessage *msg = ipc_message_new(IPC_TYPE_EVENT, len, (char *)buffer);
+  msg->event = event;
+  msg->mon = mon_num;
+
+  ipc_event_queue(msg, fields, encoding);
+
+  ipc_message_unref(msg);
+  ipc_gen_end(gen);
+}
+
+/**
+ * Pack a ClientState into an IPCBinClientState mask
+ */
+static uint8_t
+ipc_client_state_mask(const ClientState *state)
+{
+  return (state->oldstate ? IPC_BIN_STATE_OLD_STATE : 0) |
+         (state->isfixed ? IPC_BIN_STATE_FIXED : 0) |
+         (state->isfloating ? IPC_BIN_STATE_FLOATING : 0) |
+         (state->isfullscreen ? IPC_BIN_STATE_FULLSCREEN : 0) |
+         (state->isurgent ? IPC_BIN_STATE_URGENT : 0) |
+         (state->neverfocus ? IPC_BIN_STATE_NEVER_FOCUS : 0);
+}
+
+/**
+ * Header of a binary event about monitor mon_num, -1 if none
+ */
+static IPCBinEventHeader
+ipc_event_binary_header(IPCEvent event, int mon_num)
+{
+  IPCBinEventHeader header = {
+      .version = IPC_BIN_VERSION, .event = event, .mon = mon_num};
+  return header;
+}
+
+/**
+ * Queue a binary event of the specified size, starting with its header, that
+ * changed the specified IPCEventField on the subscribers that negotiated
+ * IPC_CAP_BINARY_EVENTS
+ */
+static void
+ipc_event_send_binary(const IPCBinEventHeader *header, uint32_t size,
+                      uint32_t fields)
+{
+  IPCMessage *msg = ipc_message_new(IPC_TYPE_EVENT_BIN, size, (char *)header);
+  msg->event = header->event;
+  msg->mon = header->mon;
 
-  // Not documented, but this frees temp_buffer
-  yajl_gen_free(gen);
+  ipc_event_queue(msg, fields, IPC_ENCODING_BINARY);
+
+  ipc_message_unref(msg);
 }
 
 /**
- * Initialization for generic reply message. This is used to allocate the yajl
- * handle, set yajl options, and in the future any other initialization that
- * should occur for reply messages.
+ * Initialization for generic reply message. Replies are indented for people
+ * running dwm-msg unless the client negotiated another encoding with
+ * IPC_TYPE_SET_ENCODING.
  */
 static void
-ipc_reply_init_message(yajl_gen *gen)
+ipc_reply_init_message(yajl_gen *gen, IPCClient *c)
 {
-  *gen = yajl_gen_alloc(NULL);
-  yajl_gen_config(*gen, yajl_gen_beautify, 1);
+  *gen = ipc_gen_begin(c->reply_encoding);
 }
 
 /**
@@ -274,8 +458,7 @@ ipc_reply_prepare_send_message(yajl_gen gen, IPCClient *c,
 
   ipc_prepare_send_message(c, msg_type, len, (const char *)buffer);
 
-  // Not documented, but this frees temp_buffer
-  yajl_gen_free(gen);
+  ipc_gen_end(gen);
 }
 
 /**
@@ -298,28 +481,17 @@ ipc_get_ipc_command(const char *name, IPCCommand *ipc_command)
 }
 
 /**
- * Parse a IPC_TYPE_RUN_COMMAND message from a client. This function extracts
- * the arguments, argument count, argument types, and command name and returns
- * the parsed information as an IPCParsedCommand. If this function returns
- * successfully, the parsed_command must be freed using
- * ipc_free_parsed_command_members.
+ * Extract the command name, arguments, argument count and argument types of a
+ * parsed command object into an IPCParsedCommand. The parsed_command must be
+ * zero initialized and freed using ipc_free_parsed_command_members, whether
+ * this function succeeds or not.
  *
- * Returns 0 if the message was successfully parsed
+ * Returns 0 if the command was successfully parsed
  * Returns -1 otherwise
  */
 static int
-ipc_parse_run_command(char *msg, IPCParsedCommand *parsed_command)
+ipc_parse_command_val(yajl_val parent, IPCParsedCommand *parsed_command)
 {
-  char error_buffer[1000];
-  yajl_val parent = yajl_tree_parse(msg, error_buffer, 1000);
-
-  if (parent == NULL) {
-    fputs("Failed to parse command from client\n", stderr);
-    fprintf(stderr, "%s\n", error_buffer);
-    fprintf(stderr, "Tried to parse: %s\n", msg);
-    return -1;
-  }
-
   // Format:
   // {
   //   "command": "<command name>"
@@ -330,7 +502,6 @@ ipc_parse_run_command(char *msg, IPCParsedCommand *parsed_command)
 
   if (command_val == NULL) {
     fputs("No command key found in client message\n", stderr);
-    yajl_tree_free(parent);
     return -1;
   }
 
@@ -346,7 +517,6 @@ ipc_parse_run_command(char *msg, IPCParsedCommand *parsed_command)
 
   if (args_val == NULL) {
     fputs("No args key found in client message\n", stderr);
-    yajl_tree_free(parent);
     return -1;
   }
 
@@ -366,7 +536,7 @@ ipc_parse_run_command(char *msg, IPCParsedCommand *parsed_command)
     (*argc)++;
   } else if (*argc > 0) {
     *args = (Arg *)calloc(*argc, sizeof(Arg));
-    *arg_types = (ArgType *)malloc(*argc * sizeof(ArgType));
+    *arg_types = (ArgType *)calloc(*argc, sizeof(ArgType));
 
     for (int i = 0; i < *argc; i++) {
       yajl_val arg_val = args_val->u.array.values[i];
@@ -401,9 +571,35 @@ ipc_parse_run_command(char *msg, IPCParsedCommand *parsed_command)
     }
   }
 
+  return 0;
+}
+
+/**
+ * Parse a IPC_TYPE_RUN_COMMAND message from a client. This function extracts
+ * the arguments, argument count, argument types, and command name and returns
+ * the parsed information as an IPCParsedCommand. The parsed_command must be
+ * zero initialized and freed using ipc_free_parsed_command_members.
+ *
+ * Returns 0 if the message was successfully parsed
+ * Returns -1 otherwise
+ */
+static int
+ipc_parse_run_command(char *msg, IPCParsedCommand *parsed_command)
+{
+  char error_buffer[1000];
+  yajl_val parent = yajl_tree_parse(msg, error_buffer, 1000);
+
+  if (parent == NULL) {
+    fputs("Failed to parse command from client\n", stderr);
+    fprintf(stderr, "%s\n", error_buffer);
+    fprintf(stderr, "Tried to parse: %s\n", msg);
+    return -1;
+  }
+
+  const int ret = ipc_parse_command_val(parent, parsed_command);
   yajl_tree_free(parent);
 
-  return 0;
+  return ret;
 }
 
 /**
@@ -473,21 +669,79 @@ ipc_event_stoi(const char *subscription, IPCEvent *event)
     *event = IPC_EVENT_FOCUSED_TITLE_CHANGE;
   else if (strcmp(subscription, "focused_state_change_event") == 0)
     *event = IPC_EVENT_FOCUSED_STATE_CHANGE;
+  else if (strcmp(subscription, "state_change_event") == 0)
+    *event = IPC_EVENT_STATE_CHANGE;
   else
     return -1;
   return 0;
 }
 
+typedef struct IPCFieldName {
+  IPCEvent event;
+  const char *name;
+  IPCEventField field;
+} IPCFieldName;
+
+static const IPCFieldName ipc_field_names[] = {
+    {IPC_EVENT_TAG_CHANGE, "selected", IPC_FIELD_TAG_SELECTED},
+    {IPC_EVENT_TAG_CHANGE, "occupied", IPC_FIELD_TAG_OCCUPIED},
+    {IPC_EVENT_TAG_CHANGE, "urgent", IPC_FIELD_TAG_URGENT},
+    {IPC_EVENT_LAYOUT_CHANGE, "symbol", IPC_FIELD_LAYOUT_SYMBOL},
+    {IPC_EVENT_LAYOUT_CHANGE, "address", IPC_FIELD_LAYOUT_ADDRESS},
+    {IPC_EVENT_FOCUSED_STATE_CHANGE, "old_state", IPC_FIELD_STATE_OLD_STATE},
+    {IPC_EVENT_FOCUSED_STATE_CHANGE, "is_fixed", IPC_FIELD_STATE_FIXED},
+    {IPC_EVENT_FOCUSED_STATE_CHANGE, "is_floating", IPC_FIELD_STATE_FLOATING},
+    {IPC_EVENT_FOCUSED_STATE_CHANGE, "is_fullscreen",
+     IPC_FIELD_STATE_FULLSCREEN},
+    {IPC_EVENT_FOCUSED_STATE_CHANGE, "is_urgent", IPC_FIELD_STATE_URGENT},
+    {IPC_EVENT_FOCUSED_STATE_CHANGE, "never_focus",
+     IPC_FIELD_STATE_NEVER_FOCUS}};
+
+/**
+ * Get the mask of every field that can be filtered on for the specified event
+ */
+static uint32_t
+ipc_event_fields(IPCEvent event)
+{
+  uint32_t fields = 0;
+
+  for (size_t i = 0; i < LENGTH(ipc_field_names); i++)
+    if (ipc_field_names[i].event == event) fields |= ipc_field_names[i].field;
+
+  return fields;
+}
+
+/**
+ * Convert a field name of the specified event to its IPCEventField value
+ *
+ * Returns 0 if a valid field name was given
+ * Returns -1 otherwise
+ */
+static int
+ipc_field_stoi(IPCEvent event, const char *name, uint32_t *field)
+{
+  for (size_t i = 0; i < LENGTH(ipc_field_names); i++) {
+    if (ipc_field_names[i].event == event &&
+        strcmp(ipc_field_names[i].name, name) == 0) {
+      *field = ipc_field_names[i].field;
+      return 0;
+    }
+  }
+  return -1;
+}
+
 /**
  * Parse a IPC_TYPE_SUBSCRIBE message from a client. This function extracts the
- * event name and the subscription action from the message.
+ * event name and the subscription action from the message, along with the
+ * optional monitor and field filters. monitor is left untouched if the message
+ * does not name one. fields is set to 0 if the message does not list any.
  *
  * Returns 0 if message was successfully parsed
  * Returns -1 otherwise
  */
 static int
 ipc_parse_subscribe(const char *msg, IPCSubscriptionAction *subscribe,
-                    IPCEvent *event)
+                    IPCEvent *event, int *monitor, uint32_t *fields)
 {
   char error_buffer[100];
   yajl_val parent = yajl_tree_parse((char *)msg, error_buffer, 100);
@@ -502,26 +756,28 @@ ipc_parse_subscribe(const char *msg, IPCSubscriptionAction *subscribe,
   // {
   //   "event": "<event name>"
   //   "action": "<subscribe|unsubscribe>"
+  //   "monitor": <monitor number, -1 for all>   (optional)
+  //   "fields": ["<field name>", ...]           (optional)
   // }
   const char *event_path[] = {"event", 0};
   yajl_val event_val = yajl_tree_get(parent, event_path, yajl_t_string);
 
   if (event_val == NULL) {
     fputs("No 'event' key found in client message\n", stderr);
-    return -1;
+    goto fail;
   }
 
   const char *event_str = YAJL_GET_STRING(event_val);
   DEBUG("Received event: %s\n", event_str);
 
-  if (ipc_event_stoi(event_str, event) < 0) return -1;
+  if (ipc_event_stoi(event_str, event) < 0) goto fail;
 
   const char *action_path[] = {"action", 0};
   yajl_val action_val = yajl_tree_get(parent, action_path, yajl_t_string);
 
   if (action_val == NULL) {
     fputs("No 'action' key found in client message\n", stderr);
-    return -1;
+    goto fail;
   }
 
   const char *action = YAJL_GET_STRING(action_val);
@@ -532,12 +788,46 @@ ipc_parse_subscribe(const char *msg, IPCSubscriptionAction *subscribe,
     *subscribe = IPC_ACTION_UNSUBSCRIBE;
   else {
     fputs("Invalid action specified for subscription\n", stderr);
-    return -1;
+    goto fail;
+  }
+
+  const char *monitor_path[] = {"monitor", 0};
+  yajl_val monitor_val = yajl_tree_get(parent, monitor_path, yajl_t_number);
+
+  if (monitor_val != NULL) {
+    if (!YAJL_IS_INTEGER(monitor_val)) {
+      fputs("Subscription monitor must be an integer\n", stderr);
+      goto fail;
+    }
+    long long num = YAJL_GET_INTEGER(monitor_val);
+    *monitor = num < 0 || num > INT_MAX ? -1 : (int)num;
+  }
+
+  *fields = 0;
+  const char *fields_path[] = {"fields", 0};
+  yajl_val fields_val = yajl_tree_get(parent, fields_path, yajl_t_array);
+
+  if (fields_val != NULL) {
+    for (size_t i = 0; i < fields_val->u.array.len; i++) {
+      yajl_val field_val = fields_val->u.array.values[i];
+      uint32_t field;
+
+      if (!YAJL_IS_STRING(field_val) ||
+          ipc_field_stoi(*event, YAJL_GET_STRING(field_val), &field) < 0) {
+        fputs("Invalid field specified for subscription\n", stderr);
+        goto fail;
+      }
+      *fields |= field;
+    }
   }
 
   yajl_tree_free(parent);
 
   return 0;
+
+fail:
+  yajl_tree_free(parent);
+  return -1;
 }
 
 /**
@@ -579,6 +869,93 @@ ipc_parse_get_dwm_client(const char *msg, Window *win)
   return 0;
 }
 
+/**
+ * Parse the optional payload of an IPC_TYPE_GET_MONITORS message. An empty
+ * message asks for all monitors.
+ *
+ * Returns 1 if a generation to get changes since was given
+ * Returns 0 if the message is empty
+ * Returns -1 if the message could not be parsed
+ */
+static int
+ipc_parse_get_monitors(const char *msg, unsigned long *since)
+{
+  char error_buffer[100];
+
+  if (msg == NULL || msg[0] == '\0') return 0;
+
+  yajl_val parent = yajl_tree_parse(msg, error_buffer, 100);
+
+  if (parent == NULL) {
+    fputs("Failed to parse message from client\n", stderr);
+    fprintf(stderr, "%s\n", error_buffer);
+    return -1;
+  }
+
+  // Format:
+  // {
+  //   "since": <generation>
+  // }
+  const char *since_path[] = {"since", 0};
+  yajl_val since_val = yajl_tree_get(parent, since_path, yajl_t_number);
+
+  if (since_val == NULL || !YAJL_IS_INTEGER(since_val) ||
+      YAJL_GET_INTEGER(since_val) < 0) {
+    fputs("No valid since generation found in client message\n", stderr);
+    yajl_tree_free(parent);
+    return -1;
+  }
+
+  *since = YAJL_GET_INTEGER(since_val);
+
+  yajl_tree_free(parent);
+
+  return 1;
+}
+
+/**
+ * Parse an IPC_TYPE_SET_ENCODING message from a client. This function extracts
+ * the encoding the client wants its replies and events in.
+ *
+ * Returns 0 if the message was successfully parsed
+ * Returns -1 if the message could not be parsed or names an unknown encoding
+ */
+static int
+ipc_parse_set_encoding(const char *msg, IPCEncoding *encoding)
+{
+  char error_buffer[100];
+  int ret = 0;
+
+  yajl_val parent = yajl_tree_parse(msg, error_buffer, 100);
+
+  if (parent == NULL) {
+    fputs("Failed to parse message from client\n", stderr);
+    fprintf(stderr, "%s\n", error_buffer);
+    return -1;
+  }
+
+  // Format:
+  // {
+  //   "encoding": "<compact|pretty>"
+  // }
+  const char *encoding_path[] = {"encoding", 0};
+  yajl_val encoding_val = yajl_tree_get(parent, encoding_path, yajl_t_string);
+  const char *encoding_str = encoding_val ? YAJL_GET_STRING(encoding_val) : "";
+
+  if (strcmp(encoding_str, "compact") == 0)
+    *encoding = IPC_ENCODING_COMPACT;
+  else if (strcmp(encoding_str, "pretty") == 0)
+    *encoding = IPC_ENCODING_PRETTY;
+  else {
+    fputs("No valid 'encoding' found in client message\n", stderr);
+    ret = -1;
+  }
+
+  yajl_tree_free(parent);
+
+  return ret;
+}
+
 /**
  * Called when an IPC_TYPE_RUN_COMMAND message is received from a client. This
  * function parses, executes the given command, and prepares a reply message to
@@ -604,6 +981,7 @@ ipc_run_command(IPCClient *ipc_client, char *msg)
   if (ipc_parse_run_command(msg, &parsed_command) < 0) {
     ipc_prepare_reply_failure(ipc_client, IPC_TYPE_RUN_COMMAND,
                               "Failed to parse run command");
+    ipc_free_parsed_command_members(&parsed_command);
     return -1;
   }
 
@@ -641,17 +1019,232 @@ ipc_run_command(IPCClient *ipc_client, char *msg)
 }
 
 /**
- * Called when an IPC_TYPE_GET_MONITORS message is received from a client. It
- * prepares a reply with the properties of all of the monitors in JSON.
+ * Called when an IPC_TYPE_RUN_BATCH message is received from a client. Every
+ * command is parsed and checked before any runs, so a batch runs completely
+ * or not at all. The commands run in order between ipc_batch_begin and
+ * ipc_batch_end, so monitors are arranged and restacked once for the whole
+ * batch. One reply covers the whole batch.
+ *
+ * Returns 0 if the batch ran
+ * Returns -1 if any command could not be parsed or checked
+ */
+static int
+ipc_run_batch(IPCClient *ipc_client, char *msg)
+{
+  char error_buffer[1000];
+  yajl_val parent = yajl_tree_parse(msg, error_buffer, 1000);
+
+  // Format:
+  // {
+  //   "commands": [
+  //     { "command": "<command name>", "args": [ ... ] },
+  //     ...
+  //   ]
+  // }
+  const char *commands_path[] = {"commands", 0};
+  yajl_val commands_val =
+      parent ? yajl_tree_get(parent, commands_path, yajl_t_array) : NULL;
+
+  if (commands_val == NULL) {
+    ipc_prepare_reply_failure(ipc_client, IPC_TYPE_RUN_BATCH,
+                              "Failed to parse batch, expected commands array");
+    if (parent) yajl_tree_free(parent);
+    return -1;
+  }
+
+  const size_t len = commands_val->u.array.len;
+  IPCParsedCommand *parsed = ecalloc(len + 1, sizeof(IPCParsedCommand));
+  IPCCommand *commands = ecalloc(len + 1, sizeof(IPCCommand));
+  int ret = 0;
+
+  for (size_t i = 0; i < len && ret == 0; i++) {
+    ret = -1;
+    if (ipc_parse_command_val(commands_val->u.array.values[i], &parsed[i]) < 0)
+      ipc_prepare_reply_failure(ipc_client, IPC_TYPE_RUN_BATCH,
+                                "Command %zu: failed to parse", i);
+    else if (ipc_get_ipc_command(parsed[i].name, &commands[i]) < 0)
+      ipc_prepare_reply_failure(ipc_client, IPC_TYPE_RUN_BATCH,
+                                "Command %zu: %s not found", i, parsed[i].name);
+    else {
+      const int res = ipc_validate_run_command(&parsed[i], commands[i]);
+      if (res == -1)
+        ipc_prepare_reply_failure(ipc_client, IPC_TYPE_RUN_BATCH,
+                                  "Command %zu: %u arguments provided, %u "
+                                  "expected",
+                                  i, parsed[i].argc, commands[i].argc);
+      else if (res == -2)
+        ipc_prepare_reply_failure(ipc_client, IPC_TYPE_RUN_BATCH,
+                                  "Command %zu: type mismatch", i);
+      else
+        ret = 0;
+    }
+  }
+
+  if (ret == 0) {
+    ipc_batch_begin();
+    for (size_t i = 0; i < len; i++) {
+      if (parsed[i].argc == 1)
+        commands[i].func.single_param(parsed[i].args);
+      else if (parsed[i].argc > 1)
+        commands[i].func.array_param(parsed[i].args, parsed[i].argc);
+      DEBUG("Called function for batched command %s\n", parsed[i].name);
+    }
+    ipc_batch_end();
+
+    ipc_prepare_reply_success(ipc_client, IPC_TYPE_RUN_BATCH);
+  }
+
+  for (size_t i = 0; i < len; i++) ipc_free_parsed_command_members(&parsed[i]);
+  free(parsed);
+  free(commands);
+  yajl_tree_free(parent);
+
+  return ret;
+}
+
+static uint64_t
+ipc_hash(uint64_t h, const void *data, size_t len)
+{
+  const unsigned char *p = data;
+
+  for (size_t i = 0; i < len; i++) h = (h ^ p[i]) * 0x100000001b3ULL;
+  return h;
+}
+
+/**
+ * Fingerprint of the fields of a client dump_client reports
+ */
+static uint64_t
+ipc_client_hash(const Client *c)
+{
+  const int v[] = {c->tags,       c->mon->num,   c->x,          c->y,
+                   c->w,          c->h,          c->oldx,       c->oldy,
+                   c->oldw,       c->oldh,       c->basew,      c->baseh,
+                   c->incw,       c->inch,       c->maxw,       c->maxh,
+                   c->minw,       c->minh,       c->bw,         c->oldbw,
+                   c->isfixed,    c->isfloating, c->isurgent,   c->neverfocus,
+                   c->oldstate,   c->isfullscreen};
+  const float f[] = {c->mina, c->maxa};
+  uint64_t h = IPC_HASH_INIT;
+
+  h = ipc_hash(h, v, sizeof(v));
+  h = ipc_hash(h, f, sizeof(f));
+  h = ipc_hash(h, &c->win, sizeof(c->win));
+  return ipc_hash(h, c->name, strlen(c->name));
+}
+
+/**
+ * Fingerprint of the fields of a monitor dump_monitor reports
+ */
+static uint64_t
+ipc_monitor_hash(const Monitor *m, const Monitor *selmon)
+{
+  const int v[] = {m->num,        m == selmon,   m->nmaster,    m->mx,
+                   m->my,         m->mw,         m->mh,         m->wx,
+                   m->wy,         m->ww,         m->wh,         m->tagset[0],
+                   m->tagset[1],  m->seltags,    m->sellt,      m->by,
+                   m->showbar,    m->topbar};
+  const void *lt[] = {m->lt[0], m->lt[1]};
+  const Window w[] = {m->sel ? m->sel->win : 0, m->barwin};
+  uint64_t h = IPC_HASH_INIT;
+
+  h = ipc_hash(h, v, sizeof(v));
+  h = ipc_hash(h, &m->mfact, sizeof(m->mfact));
+  h = ipc_hash(h, &m->tagstate, sizeof(m->tagstate));
+  h = ipc_hash(h, lt, sizeof(lt));
+  h = ipc_hash(h, w, sizeof(w));
+  h = ipc_hash(h, m->ltsymbol, strnlen(m->ltsymbol, sizeof(m->ltsymbol)));
+  h = ipc_hash(h, m->lastltsymbol,
+               strnlen(m->lastltsymbol, sizeof(m->lastltsymbol)));
+  for (Client *c = m->stack; c; c = c->snext)
+    h = ipc_hash(h, &c->win, sizeof(c->win));
+  // Keep the two lists apart
+  h = ipc_hash(h, "", 1);
+  for (Client *c = m->clients; c; c = c->next)
+    h = ipc_hash(h, &c->win, sizeof(c->win));
+
+  return h;
+}
+
+/**
+ * Compare the fingerprints of all monitors and clients with the last ones.
+ * Everything that changed since is stamped with a new generation. Adding or
+ * removing a client changes its monitor, adding or removing a monitor bumps
+ * the generation too. Only get_monitors looks at generations, so this runs
+ * when it is asked and not after every batch of events. Changes in between
+ * share one generation.
  */
 static void
-ipc_get_monitors(IPCClient *c, Monitor *mons, Monitor *selmon)
+ipc_update_generations(Monitor *mons, Monitor *selmon)
 {
+  const unsigned long next = ipc_generation + 1;
+  uint64_t mons_hash = IPC_HASH_INIT;
+  int changed = 0;
+
+  for (Monitor *m = mons; m; m = m->next) {
+    uint64_t h = ipc_monitor_hash(m, selmon);
+    mons_hash = ipc_hash(mons_hash, &m->num, sizeof(m->num));
+    if (h != m->ipchash) {
+      m->ipchash = h;
+      m->ipcgen = next;
+      changed = 1;
+    }
+
+    for (Client *c = m->clients; c; c = c->next) {
+      h = ipc_client_hash(c);
+      if (h != c->ipchash) {
+        c->ipchash = h;
+        c->ipcgen = next;
+        changed = 1;
+      }
+    }
+  }
+
+  if (mons_hash != ipc_mons_hash) {
+    ipc_mons_hash = mons_hash;
+    changed = 1;
+  }
+
+  if (changed) ipc_generation = next;
+}
+
+/**
+ * Called when an IPC_TYPE_GET_MONITORS message is received from a client. It
+ * prepares a reply with the properties of all of the monitors in JSON. If the
+ * message gives a generation, only what changed after it is sent. Generations
+ * start from the clock, so one from an earlier dwm is older than anything this
+ * one stamped and everything is sent. One newer than the current one can only
+ * come from an earlier dwm too, everything is sent as well.
+ *
+ * Returns 0 if the message was successfully parsed
+ * Returns -1 otherwise
+ */
+static int
+ipc_get_monitors(IPCClient *c, const char *msg, Monitor *mons,
+                 Monitor *selmon)
+{
+  unsigned long since = 0;
   yajl_gen gen;
-  ipc_reply_init_message(&gen);
-  dump_monitors(gen, mons, selmon);
+
+  const int delta = ipc_parse_get_monitors(msg, &since);
+  if (delta < 0) {
+    ipc_prepare_reply_failure(c, IPC_TYPE_GET_MONITORS,
+                              "Expected a non-negative since generation");
+    return -1;
+  }
+
+  ipc_update_generations(mons, selmon);
+  if (since > ipc_generation) since = 0;
+
+  ipc_reply_init_message(&gen, c);
+  if (delta)
+    dump_monitors_delta(gen, mons, selmon, ipc_generation, since);
+  else
+    dump_monitors(gen, mons, selmon);
 
   ipc_reply_prepare_send_message(gen, c, IPC_TYPE_GET_MONITORS);
+
+  return 0;
 }
 
 /**
@@ -662,7 +1255,7 @@ static void
 ipc_get_tags(IPCClient *c, const char *tags[], const int tags_len)
 {
   yajl_gen gen;
-  ipc_reply_init_message(&gen);
+  ipc_reply_init_message(&gen, c);
 
   dump_tags(gen, tags, tags_len);
 
@@ -677,13 +1270,44 @@ static void
 ipc_get_layouts(IPCClient *c, const Layout layouts[], const int layouts_len)
 {
   yajl_gen gen;
-  ipc_reply_init_message(&gen);
+  ipc_reply_init_message(&gen, c);
 
   dump_layouts(gen, layouts, layouts_len);
 
   ipc_reply_prepare_send_message(gen, c, IPC_TYPE_GET_LAYOUTS);
 }
 
+/**
+ * Called when an IPC_TYPE_GET_STATS message is received from a client. It
+ * prepares a reply with dwm's internal counters in JSON.
+ */
+static void
+ipc_get_stats(IPCClient *c, const Stats *stats)
+{
+  yajl_gen gen;
+  ipc_reply_init_message(&gen, c);
+
+  dump_stats(gen, stats);
+
+  ipc_reply_prepare_send_message(gen, c, IPC_TYPE_GET_STATS);
+}
+
+/**
+ * Called when an IPC_TYPE_GET_IPC_CLIENTS message is received from a client.
+ * It prepares a reply with the output queue counters of every connected IPC
+ * client in JSON.
+ */
+static void
+ipc_get_ipc_clients(IPCClient *c)
+{
+  yajl_gen gen;
+  ipc_reply_init_message(&gen, c);
+
+  dump_ipc_clients(gen, ipc_clients);
+
+  ipc_reply_prepare_send_message(gen, c, IPC_TYPE_GET_IPC_CLIENTS);
+}
+
 /**
  * Called when an IPC_TYPE_GET_DWM_CLIENT message is received from a client. It
  * prepares a JSON reply with the properties of the client with the specified
@@ -705,7 +1329,7 @@ ipc_get_dwm_client(IPCClient *ipc_client, const char *msg, const Monitor *mons)
     for (Client *c = m->clients; c; c = c->next)
       if (c->win == win) {
         yajl_gen gen;
-        ipc_reply_init_message(&gen);
+        ipc_reply_init_message(&gen, ipc_client);
 
         dump_client(gen, c);
 
@@ -720,6 +1344,18 @@ ipc_get_dwm_client(IPCClient *ipc_client, const char *msg, const Monitor *mons)
   return -1;
 }
 
+/**
+ * Recompute the union of all client subscriptions. Events nobody is subscribed
+ * to are not serialized at all.
+ */
+static void
+ipc_update_subscriptions()
+{
+  memset(ipc_subscriptions, 0, sizeof(ipc_subscriptions));
+  for (IPCClient *c = ipc_clients; c; c = c->next)
+    ipc_subscriptions[c->encoding] |= c->subscriptions;
+}
+
 /**
  * Called when an IPC_TYPE_SUBSCRIBE message is received from a client. It
  * subscribes/unsubscribes the client from the specified event and replies with
@@ -733,31 +1369,210 @@ ipc_subscribe(IPCClient *c, const char *msg)
 {
   IPCSubscriptionAction action = IPC_ACTION_SUBSCRIBE;
   IPCEvent event = 0;
+  int monitor = c->monitor;
+  uint32_t fields = 0;
 
-  if (ipc_parse_subscribe(msg, &action, &event)) {
-    ipc_prepare_reply_failure(c, IPC_TYPE_SUBSCRIBE, "Event does not exist");
+  if (ipc_parse_subscribe(msg, &action, &event, &monitor, &fields)) {
+    ipc_prepare_reply_failure(c, IPC_TYPE_SUBSCRIBE,
+                              "Event or field does not exist");
     return -1;
   }
 
+  // Only the field bits of this event are replaced so that the filters set up
+  // for the client's other subscriptions stay intact
+  const uint32_t event_fields = ipc_event_fields(event);
+
   if (action == IPC_ACTION_SUBSCRIBE) {
     DEBUG("Subscribing client on fd %d to %d\n", c->fd, event);
     c->subscriptions |= event;
+    c->monitor = monitor;
+    c->fields = (c->fields & ~event_fields) |
+                (fields ? fields & event_fields : event_fields);
   } else if (action == IPC_ACTION_UNSUBSCRIBE) {
     DEBUG("Unsubscribing client on fd %d to %d\n", c->fd, event);
-    c->subscriptions ^= event;
+    c->subscriptions &= ~event;
+    c->fields |= event_fields;
+    if (c->subscriptions == 0) c->monitor = -1;
   } else {
     ipc_prepare_reply_failure(c, IPC_TYPE_SUBSCRIBE,
                               "Invalid subscription action");
     return -1;
   }
 
+  ipc_update_subscriptions();
   ipc_prepare_reply_success(c, IPC_TYPE_SUBSCRIBE);
   return 0;
 }
 
+/**
+ * Called when an IPC_TYPE_SET_ENCODING message is received from a client. It
+ * switches the encoding of all further replies and events sent to the client
+ * and replies with the result in the new encoding.
+ *
+ * Returns 0 if the message was successfully parsed.
+ * Returns -1 if the message could not be parsed
+ */
+static int
+ipc_set_encoding(IPCClient *c, const char *msg)
+{
+  IPCEncoding encoding;
+
+  if (ipc_parse_set_encoding(msg, &encoding) < 0) {
+    ipc_prepare_reply_failure(c, IPC_TYPE_SET_ENCODING,
+                              "Encoding must be 'compact' or 'pretty'");
+    return -1;
+  }
+
+  c->encoding = encoding;
+  c->reply_encoding = encoding;
+  ipc_update_subscriptions();
+  ipc_prepare_reply_success(c, IPC_TYPE_SET_ENCODING);
+  return 0;
+}
+
+/**
+ * Called when an IPC_TYPE_HELLO message is received from a client. It grants
+ * the binary protocol capabilities the client asked for if dwm speaks its
+ * version, and replies with the granted capabilities and the command table
+ * binary run commands index into. Binary events replace JSON events until the
+ * client sets another encoding.
+ *
+ * Returns 0 if the message was successfully parsed
+ * Returns -1 if the message is too short
+ */
+static int
+ipc_hello(IPCClient *c, const char *msg, uint32_t msg_size)
+{
+  IPCBinHello hello;
+
+  if (msg_size < sizeof(hello)) {
+    ipc_prepare_reply_failure(c, IPC_TYPE_HELLO, "Malformed hello message");
+    return -1;
+  }
+  memcpy(&hello, msg, sizeof(hello));
+
+  c->caps = 0;
+  if (hello.version >= IPC_BIN_VERSION)
+    c->caps = hello.caps & (IPC_CAP_BINARY_COMMANDS | IPC_CAP_BINARY_EVENTS);
+
+  if (c->caps & IPC_CAP_BINARY_EVENTS) {
+    c->encoding = IPC_ENCODING_BINARY;
+    c->reply_encoding = IPC_ENCODING_COMPACT;
+  } else if (c->encoding == IPC_ENCODING_BINARY)
+    c->encoding = IPC_ENCODING_COMPACT;
+  ipc_update_subscriptions();
+
+  IPCBinHello reply = {.version = IPC_BIN_VERSION,
+                       .ncommands = ipc_commands_len,
+                       .caps = c->caps};
+  size_t len = sizeof(reply);
+  for (int i = 0; i < ipc_commands_len; i++)
+    len += strlen(ipc_commands[i].name) + 1;
+
+  char *buf = ecalloc(1, len);
+  char *walk = buf + sizeof(reply);
+  memcpy(buf, &reply, sizeof(reply));
+  for (int i = 0; i < ipc_commands_len; i++)
+    walk = stpcpy(walk, ipc_commands[i].name) + 1;
+
+  ipc_prepare_send_message(c, IPC_TYPE_HELLO, len, buf);
+  free(buf);
+
+  return 0;
+}
+
+/**
+ * Decode and run an IPC_TYPE_RUN_COMMAND_BIN message. The arguments are
+ * checked against the command the same way ipc_run_command() does.
+ *
+ * Returns the IPCBinStatus to reply with
+ */
+static IPCBinStatus
+ipc_exec_command_bin(IPCClient *c, const char *msg, uint32_t msg_size)
+{
+  IPCBinCommand cmd;
+  IPCBinArg arg;
+  Arg args[IPC_BIN_MAX_ARGS];
+  ArgType arg_types[IPC_BIN_MAX_ARGS];
+
+  if (!(c->caps & IPC_CAP_BINARY_COMMANDS)) return IPC_BIN_NOT_NEGOTIATED;
+  if (msg_size < sizeof(cmd)) return IPC_BIN_MALFORMED;
+  memcpy(&cmd, msg, sizeof(cmd));
+
+  if (cmd.argc > IPC_BIN_MAX_ARGS ||
+      msg_size < sizeof(cmd) + cmd.argc * sizeof(arg))
+    return IPC_BIN_MALFORMED;
+  if (cmd.command >= ipc_commands_len) return IPC_BIN_UNKNOWN_COMMAND;
+
+  IPCCommand command = ipc_commands[cmd.command];
+  IPCParsedCommand parsed = {.name = command.name,
+                             .args = args,
+                             .arg_types = arg_types,
+                             .argc = cmd.argc};
+
+  // Same dummy argument as ipc_parse_run_command() for void(Arg*) functions
+  if (cmd.argc == 0) {
+    args[0].i = 0;
+    arg_types[0] = ARG_TYPE_NONE;
+    parsed.argc = 1;
+  }
+
+  for (int i = 0; i < cmd.argc; i++) {
+    memcpy(&arg, msg + sizeof(cmd) + i * sizeof(arg), sizeof(arg));
+    if (arg.type == ARG_TYPE_UINT)
+      args[i].ui = arg.value.ui;
+    else if (arg.type == ARG_TYPE_SINT)
+      args[i].i = arg.value.i;
+    else if (arg.type == ARG_TYPE_FLOAT)
+      args[i].f = arg.value.f;
+    else
+      return IPC_BIN_TYPE_MISMATCH;
+    arg_types[i] = arg.type;
+  }
+
+  int res = ipc_validate_run_command(&parsed, command);
+  if (res == -1) return IPC_BIN_ARGC_MISMATCH;
+  if (res == -2) return IPC_BIN_TYPE_MISMATCH;
+
+  if (parsed.argc == 1)
+    command.func.single_param(parsed.args);
+  else if (parsed.argc > 1)
+    command.func.array_param(parsed.args, parsed.argc);
+
+  DEBUG("Called function for binary command %s\n", parsed.name);
+
+  return IPC_BIN_SUCCESS;
+}
+
+/**
+ * Called when an IPC_TYPE_RUN_COMMAND_BIN message is received from a client.
+ * It runs the command and replies with an IPCBinResult.
+ *
+ * Returns 0 if the command was run
+ * Returns -1 otherwise
+ */
+static int
+ipc_run_command_bin(IPCClient *c, const char *msg, uint32_t msg_size)
+{
+  IPCBinResult result = {.status = ipc_exec_command_bin(c, msg, msg_size)};
+
+  ipc_prepare_send_message(c, IPC_TYPE_RUN_COMMAND_BIN, sizeof(result),
+                           (const char *)&result);
+
+  if (result.status != IPC_BIN_SUCCESS) {
+    fprintf(stderr, "[fd %d] Error: binary command failed with status %u\n",
+            c->fd, result.status);
+    return -1;
+  }
+
+  return 0;
+}
+
 int
 ipc_init(const char *socket_path, const int p_epoll_fd, IPCCommand commands[],
-         const int commands_len)
+         const int commands_len, const uint32_t queue_max,
+         const IPCQueuePolicy queue_policy, void (*batch_begin)(void),
+         void (*batch_end)(void))
 {
   // Initialize struct to 0
   memset(&sock_epoll_event, 0, sizeof(sock_epoll_event));
@@ -767,6 +1582,11 @@ ipc_init(const char *socket_path, const int p_epoll_fd, IPCCommand commands[],
 
   ipc_commands = commands;
   ipc_commands_len = commands_len;
+  ipc_queue_max = queue_max;
+  ipc_queue_policy = queue_policy;
+  ipc_batch_begin = batch_begin;
+  ipc_batch_end = batch_end;
+  ipc_generation = (unsigned long)time(NULL) << IPC_GENERATION_SHIFT;
 
   epoll_fd = p_epoll_fd;
 
@@ -799,6 +1619,22 @@ ipc_cleanup()
   sock_fd = -1;
   ipc_commands = NULL;
   ipc_commands_len = 0;
+  if (ipc_gen) yajl_gen_free(ipc_gen);
+  ipc_gen = NULL;
+  free(ipc_fdtab);
+  ipc_fdtab = NULL;
+  ipc_fdtab_len = 0;
+
+  if (ipc_state) munmap(ipc_state, ipc_state->size);
+  if (ipc_state_fd >= 0) close(ipc_state_fd);
+  if (ipc_state_name) shm_unlink(ipc_state_name);
+  free(ipc_state_buf);
+  ipc_state = NULL;
+  ipc_state_fd = -1;
+  ipc_state_name = NULL;
+  ipc_state_buf = NULL;
+  ipc_state_buf_size = 0;
+  ipc_state_dirty = 1;
   memset(&sock_epoll_event, 0, sizeof(struct epoll_event));
   memset(&sockaddr, 0, sizeof(struct sockaddr_un));
 
@@ -809,6 +1645,158 @@ ipc_cleanup()
   close(sock_fd);
 }
 
+/**
+ * Make the shared state region at least length bytes long, growing it to the
+ * next power of two. Readers notice the new size in the header and remap.
+ *
+ * Returns 0 on success, -1 otherwise
+ */
+static int
+ipc_state_reserve(size_t length)
+{
+  const size_t size = ipc_state ? ipc_state->size : 0;
+  if (length <= size) return 0;
+
+  size_t new_size = size ? size : 4096;
+  while (new_size < length) new_size *= 2;
+
+  if (ftruncate(ipc_state_fd, new_size) < 0) return -1;
+  void *p =
+      mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, ipc_state_fd, 0);
+  if (p == MAP_FAILED) return -1;
+
+  if (ipc_state) munmap(ipc_state, size);
+  ipc_state = p;
+  ipc_state->magic = IPC_STATE_MAGIC;
+  ipc_state->version = IPC_STATE_VERSION;
+  ipc_state->size = new_size;
+
+  return 0;
+}
+
+int
+ipc_state_init(const char *name)
+{
+  ipc_state_fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (ipc_state_fd < 0) {
+    fprintf(stderr, "Failed to create shared memory state '%s'\n", name);
+    return -1;
+  }
+  ipc_state_name = name;
+
+  if (ipc_state_reserve(sizeof(IPCStateHeader)) < 0) {
+    fputs("Failed to map shared memory state\n", stderr);
+    return -1;
+  }
+  ipc_state->length = sizeof(IPCStateHeader);
+  ipc_state->selmon = -1;
+
+  return 0;
+}
+
+/**
+ * Build a snapshot of the monitors and clients and publish it in the shared
+ * state region if it differs from the published one
+ *
+ * Returns 1 if a new snapshot was published, 0 otherwise
+ */
+static int
+ipc_state_publish(Monitor *mons, Monitor *selmon)
+{
+  uint32_t nmons = 0, nclients = 0;
+
+  for (Monitor *m = mons; m; m = m->next) {
+    nmons++;
+    for (Client *c = m->clients; c; c = c->next) nclients++;
+  }
+
+  const size_t length = sizeof(IPCStateHeader) +
+                        nmons * sizeof(IPCStateMonitor) +
+                        nclients * sizeof(IPCStateClient);
+  if (length > ipc_state_buf_size) {
+    char *buf = realloc(ipc_state_buf, length);
+    if (buf == NULL) return 0;
+    ipc_state_buf = buf;
+    ipc_state_buf_size = length;
+  }
+  // Clear padding of the names too, snapshots are compared bytewise
+  memset(ipc_state_buf, 0, length);
+
+  IPCStateHeader *h = (IPCStateHeader *)ipc_state_buf;
+  IPCStateMonitor *sm = (IPCStateMonitor *)(h + 1);
+  IPCStateClient *sc = (IPCStateClient *)(sm + nmons);
+  uint32_t i = 0;
+
+  h->length = length;
+  h->nmons = nmons;
+  h->nclients = nclients;
+  h->selmon = selmon ? selmon->num : -1;
+
+  for (Monitor *m = mons; m; m = m->next, sm++) {
+    sm->num = m->num;
+    sm->mx = m->mx;
+    sm->my = m->my;
+    sm->mw = m->mw;
+    sm->mh = m->mh;
+    sm->wx = m->wx;
+    sm->wy = m->wy;
+    sm->ww = m->ww;
+    sm->wh = m->wh;
+    sm->tagset = m->tagset[m->seltags];
+    sm->occupied = m->occ;
+    sm->urgent = m->urg;
+    sm->nmaster = m->nmaster;
+    sm->mfact = m->mfact;
+    sm->first_client = i;
+    sm->sel = m->sel ? m->sel->win : 0;
+    strncpy(sm->ltsymbol, m->ltsymbol, IPC_BIN_SYMBOL_LEN - 1);
+
+    for (Client *c = m->clients; c; c = c->next, sc++, i++) {
+      sc->win = c->win;
+      sc->mon = m->num;
+      sc->tags = c->tags;
+      sc->x = c->x;
+      sc->y = c->y;
+      sc->w = c->w;
+      sc->h = c->h;
+      sc->bw = c->bw;
+      sc->state = (c->oldstate ? IPC_BIN_STATE_OLD_STATE : 0) |
+                  (c->isfixed ? IPC_BIN_STATE_FIXED : 0) |
+                  (c->isfloating ? IPC_BIN_STATE_FLOATING : 0) |
+                  (c->isfullscreen ? IPC_BIN_STATE_FULLSCREEN : 0) |
+                  (c->isurgent ? IPC_BIN_STATE_URGENT : 0) |
+                  (c->neverfocus ? IPC_BIN_STATE_NEVER_FOCUS : 0);
+      strncpy(sc->name, c->name, IPC_STATE_NAME_LEN - 1);
+    }
+    sm->nclients = i - sm->first_client;
+  }
+
+  // Everything from length on is the snapshot proper
+  const size_t off = offsetof(IPCStateHeader, length);
+  if (ipc_state->length == length &&
+      memcmp((char *)ipc_state + off, ipc_state_buf + off, length - off) == 0)
+    return 0;
+
+  if (ipc_state_reserve(length) < 0) {
+    fputs("Failed to grow shared memory state\n", stderr);
+    return 0;
+  }
+
+  const uint32_t seq = ipc_state->seq;
+  __atomic_store_n(&ipc_state->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy((char *)ipc_state + off, ipc_state_buf + off, length - off);
+  __atomic_store_n(&ipc_state->seq, seq + 2, __ATOMIC_RELEASE);
+
+  return 1;
+}
+
+void
+ipc_state_mark_dirty()
+{
+  ipc_state_dirty = 1;
+}
+
 int
 ipc_get_sock_fd()
 {
@@ -818,7 +1806,8 @@ ipc_get_sock_fd()
 IPCClient *
 ipc_get_client(int fd)
 {
-  return ipc_list_get_client(ipc_clients, fd);
+  if (fd < 0 || fd >= ipc_fdtab_len) return NULL;
+  return ipc_fdtab[fd];
 }
 
 int
@@ -840,19 +1829,28 @@ ipc_accept_client()
   memset(&client_addr, 0, sizeof(struct sockaddr_un));
 
   fd = accept(sock_fd, (struct sockaddr *)&client_addr, &len);
-  if (fd < 0 && errno != EINTR) {
-    fputs("Failed to accept IPC connection from client", stderr);
+  if (fd < 0) {
+    if (errno != EINTR)
+      fputs("Failed to accept IPC connection from client", stderr);
     return -1;
   }
 
-  if (fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+  // Reads and writes must never block the event loop
+  if (fcntl(fd, F_SETFD, FD_CLOEXEC) < 0 ||
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
     shutdown(fd, SHUT_RDWR);
     close(fd);
     fputs("Failed to set flags on new client fd", stderr);
+    return -1;
   }
 
-  IPCClient *nc = ipc_client_new(fd);
-  if (nc == NULL) return -1;
+  IPCClient *nc;
+  if (ipc_fdtab_reserve(fd) < 0 || (nc = ipc_client_new(fd)) == NULL) {
+    shutdown(fd, SHUT_RDWR);
+    close(fd);
+    fputs("Failed to allocate new IPC client", stderr);
+    return -1;
+  }
 
   // Wake up to messages from this client
   nc->event.data.fd = fd;
@@ -860,12 +1858,22 @@ ipc_accept_client()
   epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &nc->event);
 
   ipc_list_add_client(&ipc_clients, nc);
+  ipc_fdtab[fd] = nc;
 
   DEBUG("%s%d\n", "New client at fd: ", fd);
 
   return fd;
 }
 
+void
+ipc_drop_pending()
+{
+  for (IPCClient *c = ipc_clients, *next; c; c = next) {
+    next = c->next;
+    if (c->dropping) ipc_drop_client(c);
+  }
+}
+
 int
 ipc_drop_client(IPCClient *c)
 {
@@ -879,9 +1887,12 @@ ipc_drop_client(IPCClient *c)
     // Stop waking up to messages from this client
     epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, &ev);
     ipc_list_remove_client(&ipc_clients, c);
+    ipc_fdtab[fd] = NULL;
 
-    free(c->buffer);
+    ipc_client_queue_clear(c);
+    free(c->recv_buf);
     free(c);
+    ipc_update_subscriptions();
 
     DEBUG("Successfully removed client on fd %d\n", fd);
   } else if (res < 0 && res != EINTR) {
@@ -896,21 +1907,27 @@ ipc_read_client(IPCClient *c, IPCMessageType *msg_type, uint32_t *msg_size,
                 char **msg)
 {
   int fd = c->fd;
-  int ret =
-      ipc_recv_message(fd, (uint8_t *)msg_type, msg_size, (uint8_t **)msg);
+  int ret = ipc_recv_message(c);
 
-  if (ret < 0) {
-    // This will happen if these errors occur while reading header
-    if (ret == -1 &&
-        (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
-      return -2;
+  // Wait for the rest of the message
+  if (ret == 0) return -2;
 
+  if (ret < 0) {
     fprintf(stderr, "Error reading message: dropping client at fd %d\n", fd);
     ipc_drop_client(c);
 
     return -1;
   }
 
+  // Hand the message over and get ready for the next one
+  *msg_type = c->recv_type;
+  *msg_size = c->recv_size;
+  *msg = c->recv_buf;
+  c->recv_state = IPC_RECV_HEADER;
+  c->recv_buf = NULL;
+  c->recv_size = 0;
+  c->recv_len = 0;
+
   // Make sure receive message is null terminated to avoid parsing issues
   if (*msg_size > 0) {
     size_t len = *msg_size;
@@ -932,59 +1949,82 @@ ipc_read_client(IPCClient *c, IPCMessageType *msg_type, uint32_t *msg_size,
 ssize_t
 ipc_write_client(IPCClient *c)
 {
-  const ssize_t n = ipc_write_message(c->fd, c->buffer, c->buffer_size);
+  struct iovec iov[IPC_WRITEV_MAX];
+  ssize_t written = 0;
 
-  if (n < 0) return n;
+  while (c->queue_len) {
+    int iovcnt = 0;
 
-  // TODO: Deal with client timeouts
+    for (; iovcnt < c->queue_len && iovcnt < IPC_WRITEV_MAX; iovcnt++) {
+      IPCQueueEntry *e = &c->queue[(c->queue_head + iovcnt) % c->queue_cap];
+      iov[iovcnt].iov_base = e->msg->data + e->offset;
+      iov[iovcnt].iov_len = e->msg->size - e->offset;
+    }
+
+    const ssize_t n = writev(c->fd, iov, iovcnt);
 
-  if (n == c->buffer_size) {
-    c->buffer_size = 0;
-    free(c->buffer);
-    // No dangling pointers!
-    c->buffer = NULL;
-    // Stop waking up when client is ready to receive messages
-    if (c->event.events & EPOLLOUT) {
-      c->event.events -= EPOLLOUT;
-      epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &c->event);
+    if (n == -1) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      return n;
     }
-    return n;
+
+    written += n;
+    ipc_client_queue_consume(c, n);
+    DEBUG("Wrote %zd bytes to client at fd %d\n", n, c->fd);
   }
 
-  // Shift unwritten buffer to beginning of buffer and reallocate
-  c->buffer_size -= n;
-  memmove(c->buffer, c->buffer + n, c->buffer_size);
-  c->buffer = (char *)realloc(c->buffer, c->buffer_size);
+  // TODO: Deal with client timeouts
+
+  // Stop waking up when client is ready to receive messages
+  if (c->queue_len == 0 && c->event.events & EPOLLOUT) {
+    c->event.events -= EPOLLOUT;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &c->event);
+  }
 
-  return n;
+  return written;
 }
 
-void
-ipc_prepare_send_message(IPCClient *c, const IPCMessageType msg_type,
-                         const uint32_t msg_size, const char *msg)
+IPCMessage *
+ipc_message_new(const IPCMessageType msg_type, const uint32_t msg_size,
+                const char *msg)
 {
   dwm_ipc_header_t header = {
       .magic = IPC_MAGIC_ARR, .type = msg_type, .size = msg_size};
 
-  uint32_t header_size = sizeof(dwm_ipc_header_t);
-  uint32_t packet_size = header_size + msg_size;
+  const uint32_t header_size = sizeof(dwm_ipc_header_t);
+  IPCMessage *m = ecalloc(1, sizeof(IPCMessage) + header_size + msg_size);
 
-  if (c->buffer == NULL)
-    c->buffer = (char *)malloc(c->buffer_size + packet_size);
-  else
-    c->buffer = (char *)realloc(c->buffer, c->buffer_size + packet_size);
+  m->refs = 1;
+  m->event = 0;
+  m->mon = -1;
+  m->size = header_size + msg_size;
+  memcpy(m->data, &header, header_size);
+  memcpy(m->data + header_size, msg, msg_size);
 
-  // Copy header to end of client buffer
-  memcpy(c->buffer + c->buffer_size, &header, header_size);
-  c->buffer_size += header_size;
+  return m;
+}
 
-  // Copy message to end of client buffer
-  memcpy(c->buffer + c->buffer_size, msg, msg_size);
-  c->buffer_size += msg_size;
+void
+ipc_queue_message(IPCClient *c, IPCMessage *msg)
+{
+  ipc_client_queue_push(c, msg);
 
   // Wake up when client is ready to receive messages
-  c->event.events |= EPOLLOUT;
-  epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &c->event);
+  if (!(c->event.events & EPOLLOUT)) {
+    c->event.events |= EPOLLOUT;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &c->event);
+  }
+}
+
+void
+ipc_prepare_send_message(IPCClient *c, const IPCMessageType msg_type,
+                         const uint32_t msg_size, const char *msg)
+{
+  IPCMessage *m = ipc_message_new(msg_type, msg_size, msg);
+
+  ipc_queue_message(c, m);
+  ipc_message_unref(m);
 }
 
 void
@@ -1000,7 +2040,7 @@ ipc_prepare_reply_failure(IPCClient *c, IPCMessageType msg_type,
   va_end(args);
   char *buffer = (char *)malloc((len + 1) * sizeof(char));
 
-  ipc_reply_init_message(&gen);
+  ipc_reply_init_message(&gen, c);
 
   va_start(args, format);
   vsnprintf(buffer, len + 1, format, args);
@@ -1025,20 +2065,58 @@ ipc_prepare_reply_success(IPCClient *c, IPCMessageType msg_type)
 void
 ipc_tag_change_event(int mon_num, TagState old_state, TagState new_state)
 {
-  yajl_gen gen;
-  ipc_event_init_message(&gen);
-  dump_tag_event(gen, mon_num, old_state, new_state);
-  ipc_event_prepare_send_message(gen, IPC_EVENT_TAG_CHANGE);
+  const uint32_t fields =
+      (old_state.selected != new_state.selected ? IPC_FIELD_TAG_SELECTED : 0) |
+      (old_state.occupied != new_state.occupied ? IPC_FIELD_TAG_OCCUPIED : 0) |
+      (old_state.urgent != new_state.urgent ? IPC_FIELD_TAG_URGENT : 0);
+
+  for (int enc = 0; enc < IPC_ENCODING_BINARY; enc++) {
+    yajl_gen gen = ipc_event_init_message(IPC_EVENT_TAG_CHANGE, mon_num, fields,
+                                          enc);
+    if (gen == NULL) continue;
+    dump_tag_event(gen, mon_num, old_state, new_state);
+    ipc_event_prepare_send_message(gen, IPC_EVENT_TAG_CHANGE, mon_num, fields,
+                                   enc);
+  }
+
+  if (ipc_event_wanted(IPC_EVENT_TAG_CHANGE, mon_num, fields,
+                       IPC_ENCODING_BINARY)) {
+    IPCBinTagEvent e = {
+        .header = ipc_event_binary_header(IPC_EVENT_TAG_CHANGE, mon_num),
+        .old_selected = old_state.selected,
+        .old_occupied = old_state.occupied,
+        .old_urgent = old_state.urgent,
+        .new_selected = new_state.selected,
+        .new_occupied = new_state.occupied,
+        .new_urgent = new_state.urgent};
+    ipc_event_send_binary(&e.header, sizeof(e), fields);
+  }
 }
 
 void
 ipc_client_focus_change_event(int mon_num, Client *old_client,
                               Client *new_client)
 {
-  yajl_gen gen;
-  ipc_event_init_message(&gen);
-  dump_client_focus_change_event(gen, old_client, new_client, mon_num);
-  ipc_event_prepare_send_message(gen, IPC_EVENT_CLIENT_FOCUS_CHANGE);
+  const uint32_t fields = IPC_FIELD_ALL;
+
+  for (int enc = 0; enc < IPC_ENCODING_BINARY; enc++) {
+    yajl_gen gen = ipc_event_init_message(IPC_EVENT_CLIENT_FOCUS_CHANGE,
+                                          mon_num, fields, enc);
+    if (gen == NULL) continue;
+    dump_client_focus_change_event(gen, old_client, new_client, mon_num);
+    ipc_event_prepare_send_message(gen, IPC_EVENT_CLIENT_FOCUS_CHANGE, mon_num,
+                                   fields, enc);
+  }
+
+  if (ipc_event_wanted(IPC_EVENT_CLIENT_FOCUS_CHANGE, mon_num, fields,
+                       IPC_ENCODING_BINARY)) {
+    IPCBinClientFocusEvent e = {
+        .header =
+            ipc_event_binary_header(IPC_EVENT_CLIENT_FOCUS_CHANGE, mon_num),
+        .old_win = old_client ? old_client->win : 0,
+        .new_win = new_client ? new_client->win : 0};
+    ipc_event_send_binary(&e.header, sizeof(e), fields);
+  }
 }
 
 void
@@ -1046,30 +2124,87 @@ ipc_layout_change_event(const int mon_num, const char *old_symbol,
                         const Layout *old_layout, const char *new_symbol,
                         const Layout *new_layout)
 {
-  yajl_gen gen;
-  ipc_event_init_message(&gen);
-  dump_layout_change_event(gen, mon_num, old_symbol, old_layout, new_symbol,
-                           new_layout);
-  ipc_event_prepare_send_message(gen, IPC_EVENT_LAYOUT_CHANGE);
+  const uint32_t fields =
+      (strcmp(old_symbol, new_symbol) ? IPC_FIELD_LAYOUT_SYMBOL : 0) |
+      (old_layout != new_layout ? IPC_FIELD_LAYOUT_ADDRESS : 0);
+
+  for (int enc = 0; enc < IPC_ENCODING_BINARY; enc++) {
+    yajl_gen gen = ipc_event_init_message(IPC_EVENT_LAYOUT_CHANGE, mon_num,
+                                          fields, enc);
+    if (gen == NULL) continue;
+    dump_layout_change_event(gen, mon_num, old_symbol, old_layout, new_symbol,
+                             new_layout);
+    ipc_event_prepare_send_message(gen, IPC_EVENT_LAYOUT_CHANGE, mon_num,
+                                   fields, enc);
+  }
+
+  if (ipc_event_wanted(IPC_EVENT_LAYOUT_CHANGE, mon_num, fields,
+                       IPC_ENCODING_BINARY)) {
+    IPCBinLayoutEvent e = {
+        .header = ipc_event_binary_header(IPC_EVENT_LAYOUT_CHANGE, mon_num),
+        .old_address = (uintptr_t)old_layout,
+        .new_address = (uintptr_t)new_layout};
+    strncpy(e.old_symbol, old_symbol, IPC_BIN_SYMBOL_LEN);
+    strncpy(e.new_symbol, new_symbol, IPC_BIN_SYMBOL_LEN);
+    ipc_event_send_binary(&e.header, sizeof(e), fields);
+  }
 }
 
 void
 ipc_monitor_focus_change_event(const int last_mon_num, const int new_mon_num)
 {
-  yajl_gen gen;
-  ipc_event_init_message(&gen);
-  dump_monitor_focus_change_event(gen, last_mon_num, new_mon_num);
-  ipc_event_prepare_send_message(gen, IPC_EVENT_MONITOR_FOCUS_CHANGE);
+  const uint32_t fields = IPC_FIELD_ALL;
+
+  for (int enc = 0; enc < IPC_ENCODING_BINARY; enc++) {
+    yajl_gen gen = ipc_event_init_message(IPC_EVENT_MONITOR_FOCUS_CHANGE, -1,
+                                          fields, enc);
+    if (gen == NULL) continue;
+    dump_monitor_focus_change_event(gen, last_mon_num, new_mon_num);
+    ipc_event_prepare_send_message(gen, IPC_EVENT_MONITOR_FOCUS_CHANGE, -1,
+                                   fields, enc);
+  }
+
+  if (ipc_event_wanted(IPC_EVENT_MONITOR_FOCUS_CHANGE, -1, fields,
+                       IPC_ENCODING_BINARY)) {
+    IPCBinMonitorFocusEvent e = {
+        .header = ipc_event_binary_header(IPC_EVENT_MONITOR_FOCUS_CHANGE, -1),
+        .old_mon = last_mon_num,
+        .new_mon = new_mon_num};
+    ipc_event_send_binary(&e.header, sizeof(e), fields);
+  }
 }
 
 void
 ipc_focused_title_change_event(const int mon_num, const Window client_id,
                                const char *old_name, const char *new_name)
 {
-  yajl_gen gen;
-  ipc_event_init_message(&gen);
-  dump_focused_title_change_event(gen, mon_num, client_id, old_name, new_name);
-  ipc_event_prepare_send_message(gen, IPC_EVENT_FOCUSED_TITLE_CHANGE);
+  const uint32_t fields = IPC_FIELD_ALL;
+
+  for (int enc = 0; enc < IPC_ENCODING_BINARY; enc++) {
+    yajl_gen gen = ipc_event_init_message(IPC_EVENT_FOCUSED_TITLE_CHANGE,
+                                          mon_num, fields, enc);
+    if (gen == NULL) continue;
+    dump_focused_title_change_event(gen, mon_num, client_id, old_name,
+                                    new_name);
+    ipc_event_prepare_send_message(gen, IPC_EVENT_FOCUSED_TITLE_CHANGE, mon_num,
+                                   fields, enc);
+  }
+
+  if (ipc_event_wanted(IPC_EVENT_FOCUSED_TITLE_CHANGE, mon_num, fields,
+                       IPC_ENCODING_BINARY)) {
+    IPCBinTitleEvent e = {
+        .header =
+            ipc_event_binary_header(IPC_EVENT_FOCUSED_TITLE_CHANGE, mon_num),
+        .win = client_id,
+        .old_len = strnlen(old_name, UINT16_MAX),
+        .new_len = strnlen(new_name, UINT16_MAX)};
+    char buf[sizeof(e) + e.old_len + e.new_len];
+
+    memcpy(buf, &e, sizeof(e));
+    memcpy(buf + sizeof(e), old_name, e.old_len);
+    memcpy(buf + sizeof(e) + e.old_len, new_name, e.new_len);
+    ipc_event_send_binary((IPCBinEventHeader *)buf, sizeof(buf), fields);
+  }
 }
 
 void
@@ -1077,27 +2212,63 @@ ipc_focused_state_change_event(const int mon_num, const Window client_id,
                                const ClientState *old_state,
                                const ClientState *new_state)
 {
-  yajl_gen gen;
-  ipc_event_init_message(&gen);
-  dump_focused_state_change_event(gen, mon_num, client_id, old_state,
-                                  new_state);
-  ipc_event_prepare_send_message(gen, IPC_EVENT_FOCUSED_STATE_CHANGE);
+  const uint32_t fields = (uint32_t)(ipc_client_state_mask(old_state) ^
+                                     ipc_client_state_mask(new_state))
+                          << IPC_FIELD_STATE_SHIFT;
+
+  for (int enc = 0; enc < IPC_ENCODING_BINARY; enc++) {
+    yajl_gen gen = ipc_event_init_message(IPC_EVENT_FOCUSED_STATE_CHANGE,
+                                          mon_num, fields, enc);
+    if (gen == NULL) continue;
+    dump_focused_state_change_event(gen, mon_num, client_id, old_state,
+                                    new_state);
+    ipc_event_prepare_send_message(gen, IPC_EVENT_FOCUSED_STATE_CHANGE, mon_num,
+                                   fields, enc);
+  }
+
+  if (ipc_event_wanted(IPC_EVENT_FOCUSED_STATE_CHANGE, mon_num, fields,
+                       IPC_ENCODING_BINARY)) {
+    IPCBinStateEvent e = {
+        .header =
+            ipc_event_binary_header(IPC_EVENT_FOCUSED_STATE_CHANGE, mon_num),
+        .win = client_id,
+        .old_state = ipc_client_state_mask(old_state),
+        .new_state = ipc_client_state_mask(new_state)};
+    ipc_event_send_binary(&e.header, sizeof(e), fields);
+  }
 }
 
 void
-ipc_send_events(Monitor *mons, Monitor **lastselmon, Monitor *selmon)
+ipc_state_change_event(const uint32_t sequence)
 {
-  for (Monitor *m = mons; m; m = m->next) {
-    unsigned int urg = 0, occ = 0, tagset = 0;
+  const uint32_t fields = IPC_FIELD_ALL;
+
+  for (int enc = 0; enc < IPC_ENCODING_BINARY; enc++) {
+    yajl_gen gen = ipc_event_init_message(IPC_EVENT_STATE_CHANGE, -1, fields,
+                                          enc);
+    if (gen == NULL) continue;
+    dump_state_change_event(gen, sequence);
+    ipc_event_prepare_send_message(gen, IPC_EVENT_STATE_CHANGE, -1, fields,
+                                   enc);
+  }
 
-    for (Client *c = m->clients; c; c = c->next) {
-      occ |= c->tags;
+  if (ipc_event_wanted(IPC_EVENT_STATE_CHANGE, -1, fields,
+                       IPC_ENCODING_BINARY)) {
+    IPCBinStateChangeEvent e = {
+        .header = ipc_event_binary_header(IPC_EVENT_STATE_CHANGE, -1),
+        .sequence = sequence};
+    ipc_event_send_binary(&e.header, sizeof(e), fields);
+  }
+}
 
-      if (c->isurgent) urg |= c->tags;
-    }
-    tagset = m->tagset[m->seltags];
+void
+ipc_send_events(Monitor *mons, Monitor **lastselmon, Monitor *selmon)
+{
+  for (Monitor *m = mons; m; m = m->next) {
+    unsigned int tagset = m->tagset[m->seltags];
 
-    TagState new_state = {.selected = tagset, .occupied = occ, .urgent = urg};
+    TagState new_state = {
+        .selected = tagset, .occupied = m->occ, .urgent = m->urg};
 
     if (memcmp(&m->tagstate, &new_state, sizeof(TagState)) != 0) {
       ipc_tag_change_event(m->num, m->tagstate, new_state);
@@ -1137,44 +2308,71 @@ ipc_send_events(Monitor *mons, Monitor **lastselmon, Monitor *selmon)
       *o = n;
     }
   }
+
+  if (ipc_state && ipc_state_dirty) {
+    ipc_state_dirty = 0;
+    if (ipc_state_publish(mons, selmon))
+      ipc_state_change_event(ipc_state->seq);
+  }
 }
 
 int
 ipc_handle_client_epoll_event(struct epoll_event *ev, Monitor *mons,
                               Monitor **lastselmon, Monitor *selmon,
                               const char *tags[], const int tags_len,
-                              const Layout *layouts, const int layouts_len)
+                              const Layout *layouts, const int layouts_len,
+                              const Stats *stats)
 {
   int fd = ev->data.fd;
   IPCClient *c = ipc_get_client(fd);
 
+  // Dropped once the current epoll batch is done
+  if (c->dropping) return 0;
+
   if (ev->events & EPOLLHUP) {
     DEBUG("EPOLLHUP received from client at fd %d\n", fd);
     ipc_drop_client(c);
   } else if (ev->events & EPOLLOUT) {
     DEBUG("Sending message to client at fd %d...\n", fd);
-    if (c->buffer_size) ipc_write_client(c);
+    if (c->queue_len) ipc_write_client(c);
   } else if (ev->events & EPOLLIN) {
     IPCMessageType msg_type = 0;
     uint32_t msg_size = 0;
     char *msg = NULL;
 
     DEBUG("Received message from fd %d\n", fd);
-    if (ipc_read_client(c, &msg_type, &msg_size, &msg) < 0) return -1;
-
-    if (msg_type == IPC_TYPE_GET_MONITORS)
-      ipc_get_monitors(c, mons, selmon);
-    else if (msg_type == IPC_TYPE_GET_TAGS)
+    const int ret = ipc_read_client(c, &msg_type, &msg_size, &msg);
+    // Only part of the message has arrived so far
+    if (ret == -2) return 0;
+    if (ret < 0) return -1;
+
+    if (msg_type == IPC_TYPE_GET_MONITORS) {
+      if (ipc_get_monitors(c, msg, mons, selmon) < 0) return -1;
+    } else if (msg_type == IPC_TYPE_GET_TAGS)
       ipc_get_tags(c, tags, tags_len);
     else if (msg_type == IPC_TYPE_GET_LAYOUTS)
       ipc_get_layouts(c, layouts, layouts_len);
+    else if (msg_type == IPC_TYPE_GET_STATS)
+      ipc_get_stats(c, stats);
+    else if (msg_type == IPC_TYPE_GET_IPC_CLIENTS)
+      ipc_get_ipc_clients(c);
     else if (msg_type == IPC_TYPE_RUN_COMMAND) {
       if (ipc_run_command(c, msg) < 0) return -1;
       ipc_send_events(mons, lastselmon, selmon);
+    } else if (msg_type == IPC_TYPE_RUN_BATCH) {
+      if (ipc_run_batch(c, msg) < 0) return -1;
+      ipc_send_events(mons, lastselmon, selmon);
+    } else if (msg_type == IPC_TYPE_RUN_COMMAND_BIN) {
+      if (ipc_run_command_bin(c, msg, msg_size) < 0) return -1;
+      ipc_send_events(mons, lastselmon, selmon);
     } else if (msg_type == IPC_TYPE_GET_DWM_CLIENT) {
       if (ipc_get_dwm_client(c, msg, mons) < 0) return -1;
     } else if (msg_type == IPC_TYPE_SUBSCRIBE) {
       if (ipc_subscribe(c, msg) < 0) return -1;
+    } else if (msg_type == IPC_TYPE_SET_ENCODING) {
+      if (ipc_set_encoding(c, msg) < 0) return -1;
+    } else if (msg_type == IPC_TYPE_HELLO) {
+      if (ipc_hello(c, msg, msg_size) < 0) return -1;
     } else {
       fprintf(stderr, "Invalid message type received from fd %d", fd);
       ipc_prepare_reply_failure(c, msg_type, "Invalid message type: %d",
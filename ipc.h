@@ -23,18 +23,61 @@ typedef enum IPCMessageType {
   IPC_TYPE_GET_LAYOUTS = 3,
   IPC_TYPE_GET_DWM_CLIENT = 4,
   IPC_TYPE_SUBSCRIBE = 5,
-  IPC_TYPE_EVENT = 6
+  IPC_TYPE_EVENT = 6,
+  IPC_TYPE_GET_STATS = 7,
+  IPC_TYPE_SET_ENCODING = 8,
+  IPC_TYPE_GET_IPC_CLIENTS = 9,
+  IPC_TYPE_HELLO = 10,
+  IPC_TYPE_RUN_COMMAND_BIN = 11,
+  IPC_TYPE_EVENT_BIN = 12,
+  IPC_TYPE_RUN_BATCH = 13
 } IPCMessageType;
 
+typedef enum IPCQueuePolicy {
+  IPC_QUEUE_DROP_OLDEST = 0,  // Drop the oldest queued events
+  IPC_QUEUE_COALESCE = 1,     // Keep only the latest event per type and monitor
+  IPC_QUEUE_DISCONNECT = 2    // Disconnect the client
+} IPCQueuePolicy;
+
+typedef enum IPCEncoding {
+  IPC_ENCODING_COMPACT = 0,
+  IPC_ENCODING_PRETTY = 1,
+  IPC_ENCODING_BINARY = 2,  // Binary events, replies become compact JSON
+  IPC_ENCODING_LAST
+} IPCEncoding;
+
 typedef enum IPCEvent {
   IPC_EVENT_TAG_CHANGE = 1 << 0,
   IPC_EVENT_CLIENT_FOCUS_CHANGE = 1 << 1,
   IPC_EVENT_LAYOUT_CHANGE = 1 << 2,
   IPC_EVENT_MONITOR_FOCUS_CHANGE = 1 << 3,
   IPC_EVENT_FOCUSED_TITLE_CHANGE = 1 << 4,
-  IPC_EVENT_FOCUSED_STATE_CHANGE = 1 << 5
+  IPC_EVENT_FOCUSED_STATE_CHANGE = 1 << 5,
+  IPC_EVENT_STATE_CHANGE = 1 << 6
 } IPCEvent;
 
+/**
+ * Parts of an event a subscriber can ask for, see ipc_subscribe(). An event
+ * that changed none of the fields a client asked for is not sent to it. Events
+ * without fields are always sent.
+ */
+#define IPC_FIELD_STATE_SHIFT 5
+typedef enum IPCEventField {
+  IPC_FIELD_TAG_SELECTED = 1 << 0,
+  IPC_FIELD_TAG_OCCUPIED = 1 << 1,
+  IPC_FIELD_TAG_URGENT = 1 << 2,
+  IPC_FIELD_LAYOUT_SYMBOL = 1 << 3,
+  IPC_FIELD_LAYOUT_ADDRESS = 1 << 4,
+  // IPCBinClientState bits shifted by IPC_FIELD_STATE_SHIFT
+  IPC_FIELD_STATE_OLD_STATE = 1 << 5,
+  IPC_FIELD_STATE_FIXED = 1 << 6,
+  IPC_FIELD_STATE_FLOATING = 1 << 7,
+  IPC_FIELD_STATE_FULLSCREEN = 1 << 8,
+  IPC_FIELD_STATE_URGENT = 1 << 9,
+  IPC_FIELD_STATE_NEVER_FOCUS = 1 << 10
+} IPCEventField;
+#define IPC_FIELD_ALL UINT32_MAX
+
 typedef enum IPCSubscriptionAction {
   IPC_ACTION_UNSUBSCRIBE = 0,
   IPC_ACTION_SUBSCRIBE = 1
@@ -49,6 +92,197 @@ typedef struct dwm_ipc_header {
   uint8_t type;
 } __attribute((packed)) dwm_ipc_header_t;
 
+// IPCClient.h sizes the receive buffer of a header without seeing this struct
+typedef char ipc_header_size_check[
+    sizeof(dwm_ipc_header_t) == IPC_HEADER_SIZE ? 1 : -1];
+
+/*
+ * Binary protocol. A client opts in with IPC_TYPE_HELLO and then sends
+ * IPC_TYPE_RUN_COMMAND_BIN instead of JSON run commands and/or receives
+ * IPC_TYPE_EVENT_BIN instead of JSON events. All binary payloads are packed
+ * and use the native byte order, the socket is local. Layouts only change
+ * together with IPC_BIN_VERSION.
+ */
+#define IPC_BIN_VERSION 1
+#define IPC_BIN_MAX_ARGS 8
+#define IPC_BIN_SYMBOL_LEN 16
+
+typedef enum IPCCapability {
+  IPC_CAP_BINARY_COMMANDS = 1 << 0,
+  IPC_CAP_BINARY_EVENTS = 1 << 1
+} IPCCapability;
+
+typedef enum IPCBinStatus {
+  IPC_BIN_SUCCESS = 0,
+  IPC_BIN_NOT_NEGOTIATED = 1,  // IPC_CAP_BINARY_COMMANDS was not granted
+  IPC_BIN_MALFORMED = 2,
+  IPC_BIN_UNKNOWN_COMMAND = 3,
+  IPC_BIN_ARGC_MISMATCH = 4,
+  IPC_BIN_TYPE_MISMATCH = 5
+} IPCBinStatus;
+
+/**
+ * Payload of IPC_TYPE_HELLO in both directions. The client sends the highest
+ * version it speaks and the capabilities it wants, ncommands is ignored. dwm
+ * replies with its version and the capabilities it granted, no capabilities if
+ * the client's version is unsupported. The reply is followed by ncommands null
+ * terminated command names, the position of a name is the index
+ * IPC_TYPE_RUN_COMMAND_BIN refers to the command by.
+ */
+typedef struct IPCBinHello {
+  uint16_t version;
+  uint16_t ncommands;
+  uint32_t caps;
+} __attribute((packed)) IPCBinHello;
+
+/**
+ * Payload of IPC_TYPE_RUN_COMMAND_BIN, followed by argc IPCBinArg. Commands
+ * without arguments send argc 0. dwm replies with an IPCBinResult.
+ */
+typedef struct IPCBinCommand {
+  uint16_t command;
+  uint8_t argc;
+  uint8_t reserved;
+} __attribute((packed)) IPCBinCommand;
+
+/**
+ * A command argument, type is ARG_TYPE_UINT, ARG_TYPE_SINT or ARG_TYPE_FLOAT.
+ * String arguments are only supported by IPC_TYPE_RUN_COMMAND.
+ */
+typedef struct IPCBinArg {
+  uint8_t type;
+  uint8_t reserved[7];
+  union {
+    uint64_t ui;
+    int64_t i;
+    float f;
+  } value;
+} __attribute((packed)) IPCBinArg;
+
+typedef struct IPCBinResult {
+  uint32_t status;  // IPCBinStatus
+} __attribute((packed)) IPCBinResult;
+
+/**
+ * Every IPC_TYPE_EVENT_BIN payload starts with this header, followed by the
+ * fields of the event. mon is the monitor the event is about, -1 if none.
+ */
+typedef struct IPCBinEventHeader {
+  uint16_t version;
+  uint16_t event;  // IPCEvent
+  int32_t mon;
+} __attribute((packed)) IPCBinEventHeader;
+
+typedef struct IPCBinTagEvent {
+  IPCBinEventHeader header;
+  uint32_t old_selected, old_occupied, old_urgent;
+  uint32_t new_selected, new_occupied, new_urgent;
+} __attribute((packed)) IPCBinTagEvent;
+
+// Window ids are 0 if no client was or is focused
+typedef struct IPCBinClientFocusEvent {
+  IPCBinEventHeader header;
+  uint64_t old_win;
+  uint64_t new_win;
+} __attribute((packed)) IPCBinClientFocusEvent;
+
+// Symbols are null terminated unless they fill the whole array
+typedef struct IPCBinLayoutEvent {
+  IPCBinEventHeader header;
+  uint64_t old_address;
+  uint64_t new_address;
+  char old_symbol[IPC_BIN_SYMBOL_LEN];
+  char new_symbol[IPC_BIN_SYMBOL_LEN];
+} __attribute((packed)) IPCBinLayoutEvent;
+
+typedef struct IPCBinMonitorFocusEvent {
+  IPCBinEventHeader header;
+  int32_t old_mon;
+  int32_t new_mon;
+} __attribute((packed)) IPCBinMonitorFocusEvent;
+
+// Followed by old_len bytes of the old and new_len bytes of the new title
+typedef struct IPCBinTitleEvent {
+  IPCBinEventHeader header;
+  uint64_t win;
+  uint16_t old_len;
+  uint16_t new_len;
+} __attribute((packed)) IPCBinTitleEvent;
+
+typedef enum IPCBinClientState {
+  IPC_BIN_STATE_OLD_STATE = 1 << 0,
+  IPC_BIN_STATE_FIXED = 1 << 1,
+  IPC_BIN_STATE_FLOATING = 1 << 2,
+  IPC_BIN_STATE_FULLSCREEN = 1 << 3,
+  IPC_BIN_STATE_URGENT = 1 << 4,
+  IPC_BIN_STATE_NEVER_FOCUS = 1 << 5
+} IPCBinClientState;
+
+// States are IPCBinClientState masks
+typedef struct IPCBinStateEvent {
+  IPCBinEventHeader header;
+  uint64_t win;
+  uint8_t old_state;
+  uint8_t new_state;
+} __attribute((packed)) IPCBinStateEvent;
+
+typedef struct IPCBinStateChangeEvent {
+  IPCBinEventHeader header;
+  uint32_t sequence;
+} __attribute((packed)) IPCBinStateChangeEvent;
+
+/*
+ * State snapshot in shared memory, see ipc_state_init(). Readers shm_open()
+ * and mmap() it read-only. The region starts with an IPCStateHeader, followed
+ * by nmons IPCStateMonitor and nclients IPCStateClient. The clients of a
+ * monitor are consecutive, in the monitor's client list order.
+ *
+ * The region is a seqlock: seq is odd while dwm writes and grows by 2 with
+ * every change. A reader loads seq, retries while it is odd, copies length
+ * bytes, and keeps the copy if seq still has the same value. If size exceeds
+ * the mapped size, the region grew and must be mapped again.
+ */
+#define IPC_STATE_MAGIC 0x534d5744  // "DWMS" in little endian
+#define IPC_STATE_VERSION 1
+#define IPC_STATE_NAME_LEN 256
+
+typedef struct IPCStateHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t seq;
+  uint32_t size;  // Size of the region
+  // Only consistent between two reads of the same even seq
+  uint32_t length;  // Bytes of the snapshot, header included
+  uint32_t nmons;
+  uint32_t nclients;
+  int32_t selmon;  // Number of the selected monitor
+} IPCStateHeader;
+
+typedef struct IPCStateMonitor {
+  int32_t num;
+  int32_t mx, my, mw, mh;
+  int32_t wx, wy, ww, wh;
+  uint32_t tagset;
+  uint32_t occupied;
+  uint32_t urgent;
+  int32_t nmaster;
+  float mfact;
+  uint32_t first_client;  // Index of the first client in the client table
+  uint32_t nclients;
+  uint64_t sel;  // Window of the selected client, 0 if none
+  char ltsymbol[IPC_BIN_SYMBOL_LEN];  // Null terminated, truncated if needed
+} __attribute((packed)) IPCStateMonitor;
+
+typedef struct IPCStateClient {
+  uint64_t win;
+  int32_t mon;
+  uint32_t tags;
+  int32_t x, y, w, h;
+  int32_t bw;
+  uint8_t state;  // IPCBinClientState mask
+  char name[IPC_STATE_NAME_LEN];
+} __attribute((packed)) IPCStateClient;
+
 typedef enum ArgType {
   ARG_TYPE_NONE = 0,
   ARG_TYPE_UINT = 1,
@@ -87,12 +321,20 @@ typedef struct IPCParsedCommand {
  * @param epoll_fd File descriptor for epoll
  * @param commands Address of IPCCommands array defined in config.h
  * @param commands_len Length of commands[] array
+ * @param queue_max Bytes of events queued on a client that isn't reading
+ *   before queue_policy applies
+ * @param queue_policy What to do with events that would exceed queue_max
+ * @param batch_begin Called before the commands of a batch run, defers
+ *   arranging until batch_end
+ * @param batch_end Called after the commands of a batch ran
  *
  * @return int The file descriptor of the socket if it was successfully created,
  *   -1 otherwise
  */
 int ipc_init(const char *socket_path, const int p_epoll_fd,
-             IPCCommand commands[], const int commands_len);
+             IPCCommand commands[], const int commands_len,
+             const uint32_t queue_max, const IPCQueuePolicy queue_policy,
+             void (*batch_begin)(void), void (*batch_end)(void));
 
 /**
  * Uninitialize the socket and module. Free allocated memory and restore static
@@ -100,6 +342,24 @@ int ipc_init(const char *socket_path, const int p_epoll_fd,
  */
 void ipc_cleanup();
 
+/**
+ * Create the shared memory state snapshot. ipc_send_events keeps it current and
+ * emits IPC_EVENT_STATE_CHANGE whenever it changes. ipc_cleanup removes it.
+ *
+ * @param name Name of the POSIX shared memory object
+ *
+ * @return 0 if the snapshot was created, -1 otherwise
+ */
+int ipc_state_init(const char *name);
+
+/**
+ * Note that something the state snapshot covers may have changed: a monitor's
+ *   geometry, tags, layout or selection, or a client's tags, geometry, state
+ *   or name. ipc_send_events only rebuilds the snapshot after this was called,
+ *   so an idle batch of events doesn't walk every client.
+ */
+void ipc_state_mark_dirty();
+
 /**
  * Get the file descriptor of the IPC socket
  *
@@ -112,7 +372,9 @@ int ipc_get_sock_fd();
  *
  * @param fd File descriptor of IPC Client
  *
- * @return Address to IPCClient with specified file descriptor, -1 otherwise
+ * @return Address to IPCClient with specified file descriptor, NULL otherwise
+ *
+ * This is a constant time lookup in a table indexed by file descriptor.
  */
 IPCClient *ipc_get_client(int fd);
 
@@ -136,6 +398,14 @@ int ipc_is_client_registered(int fd);
  */
 int ipc_drop_client(IPCClient *c);
 
+/**
+ * Disconnect every IPCClient the queue policy gave up on. Clients are only
+ *   marked while events are queued, since dropping one in the middle of an
+ *   epoll batch would leave later events of the batch with a freed client.
+ *   Call this once all events of the batch were handled.
+ */
+void ipc_drop_pending();
+
 /**
  * Accept an IPC Client requesting to connect to the socket and add it to the
  *   list of clients
@@ -155,16 +425,20 @@ int ipc_accept_client();
  * @param msg Address to char* variable which will be assigned the address of
  *   the received message. This must be freed using free().
  *
- * @return 0 on success, -1 on error reading message, -2 if reading the message
- * resulted in EAGAIN, EINTR, or EWOULDBLOCK.
+ * Partially received messages are kept in the client and completed by later
+ * calls, this never blocks waiting for the rest of a message.
+ *
+ * @return 0 on success, -1 on error reading message (the client is dropped),
+ * -2 if the message is not complete yet.
  */
 int ipc_read_client(IPCClient *c, IPCMessageType *msg_type, uint32_t *msg_size,
                     char **msg);
 
 /**
- * Write any pending buffer of the client to the client's socket
+ * Write as much of the client's output queue to the client's socket as it
+ * accepts without blocking, gathering several queued messages per writev()
  *
- * @param c Client whose buffer to write
+ * @param c Client whose queue to write
  *
  * @return Number of bytes written >= 0, -1 otherwise. errno will still be set
  * from the write operation.
@@ -172,7 +446,29 @@ int ipc_read_client(IPCClient *c, IPCMessageType *msg_type, uint32_t *msg_size,
 ssize_t ipc_write_client(IPCClient *c);
 
 /**
- * Prepare a message in the specified client's buffer.
+ * Create a message holding the IPC header and a copy of the payload. The
+ * caller owns the only reference and releases it with ipc_message_unref().
+ *
+ * @param msg_type Type of message
+ * @param msg_size Size of the payload in bytes
+ * @param msg Payload (not including header)
+ *
+ * @return The new message
+ */
+IPCMessage *ipc_message_new(const IPCMessageType msg_type,
+                            const uint32_t msg_size, const char *msg);
+
+/**
+ * Queue a message on the specified client and wait for the client's socket to
+ * become writable. The queue takes its own reference to the message.
+ *
+ * @param c Client to queue the message on
+ * @param msg Message to queue
+ */
+void ipc_queue_message(IPCClient *c, IPCMessage *msg);
+
+/**
+ * Prepare a message in the specified client's output queue.
  *
  * @param c Client to prepare message for
  * @param msg_type Type of message to prepare
@@ -275,7 +571,7 @@ void ipc_focused_state_change_event(const int mon_num, const Window client_id,
                                     const ClientState *new_state);
 /**
  * Check to see if an event has occured and call the *_change_event functions
- * accordingly
+ * accordingly. Publishes the state snapshot if it changed.
  *
  * @param mons Address of Monitor pointing to start of linked list
  * @param lastselmon Address of pointer to previously selected monitor
@@ -283,6 +579,14 @@ void ipc_focused_state_change_event(const int mon_num, const Window client_id,
  */
 void ipc_send_events(Monitor *mons, Monitor **lastselmon, Monitor *selmon);
 
+/**
+ * Send a state_change_event to all subscribers, the shared state snapshot
+ * changed
+ *
+ * @param sequence seq of the new snapshot
+ */
+void ipc_state_change_event(const uint32_t sequence);
+
 /**
  * Handle an epoll event caused by a registered IPC client. Read, process, and
  * handle any received messages from clients. Write pending buffer to client if
@@ -297,6 +601,7 @@ void ipc_send_events(Monitor *mons, Monitor **lastselmon, Monitor *selmon);
  * @param tags_len Length of tags array
  * @param layouts Array of available layouts
  * @param layouts_len Length of layouts array
+ * @param stats Counters to report for IPC_TYPE_GET_STATS
  *
  * @return 0 if event was successfully handled, -1 on any error receiving
  * or handling incoming messages or unhandled epoll event.
@@ -304,7 +609,8 @@ void ipc_send_events(Monitor *mons, Monitor **lastselmon, Monitor *selmon);
 int ipc_handle_client_epoll_event(struct epoll_event *ev, Monitor *mons,
                                   Monitor **lastselmon, Monitor *selmon,
                                   const char *tags[], const int tags_len,
-                                  const Layout *layouts, const int layouts_len);
+                                  const Layout *layouts, const int layouts_len,
+                                  const Stats *stats);
 
 /**
  * Handle an epoll event caused by the IPC socket. This function only handles an
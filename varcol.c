@@ -11,18 +11,26 @@
 	- Supports nmaster
 */
 
+static void varcolrects(const LayoutMonitor *lm, const LayoutClient *lc, unsigned int n,
+				LayoutRect *r, char *symbol);
+
 /* The relative factors for the size of each column */
 static const float colfact[3]			= { 0.1, 0.6, 0.3 };
 
+/* The left column is not worth using on a small monitor */
+static int useleft(int mw, int isleft)
+{
+	return(isleft && mw > 2000);
+}
+
 static int isleft(Client *c)
 {
 	if (c == NULL) {
 		return 0;
 	}
 
-	if (c->mon != NULL && c->mon->mw <= 2000) {
-		/* The left column is not worth using on a small monitor */
-		return 0;
+	if (c->mon != NULL) {
+		return useleft(c->mon->mw, c->isLeft);
 	}
 
 	return c->isLeft;
@@ -34,7 +42,7 @@ static int ismaster(void)
 	Client	*c;
 	int		i;
 
-	if (!selmon || !selmon->lt[selmon->sellt]->arrange || !selmon->sel) {
+	if (!selmon || !ISTILED(selmon) || !selmon->sel) {
 		return 0;
 	}
 
@@ -57,7 +65,7 @@ void setcolfact(const Arg *arg)
 {
 	int		index = 1;
 
-	if (!arg || !selmon || !selmon->lt[selmon->sellt]->arrange || !selmon->sel) {
+	if (!arg || !selmon || !ISTILED(selmon) || !selmon->sel) {
 		return;
 	}
 
@@ -99,71 +107,105 @@ static void pushleft(const Arg *arg)
 	arrange(selmon);
 }
 
-static Client * placeColumn(Monitor *m, Client *first, int count, int *x, int w)
+/* Column a tiled client is placed in, in the order the columns are filled */
+enum { ColMaster, ColRight, ColLeft };
+
+static int varcolcolumn(const LayoutMonitor *lm, const LayoutClient *lc, unsigned int i)
 {
-	Client	*c;
-	int		i, y;
-	int		cw, ch;
-	int		wh		= m->wh;
-	float	cfacts	= 0;
+	if (i < lm->nmaster) {
+		return(ColMaster);
+	}
 
-	if (!count || !first || !(c = nexttiled(first))) {
-		return(first);
+	if (useleft(lm->mw, lc[i].isleft)) {
+		return(ColLeft);
 	}
 
+	return(ColRight);
+}
+
+/*
+	Place the next count clients of the given column type, starting the search
+	at *next, in a column of width w at *x. The rects are used as scratch space
+	for the heights that are fixed by size hints.
+*/
+static void placeColumn(const LayoutMonitor *lm, const LayoutClient *lc,
+				unsigned int n, LayoutRect *r, int col, unsigned int *next,
+				unsigned int count, int *x, int w)
+{
+	unsigned int	i, placed;
+	int				y;
+	int				cw, ch;
+	int				wh		= lm->wh;
+	float			cfacts	= 0;
+	LayoutRect		f;
+
 	/* 1st pass to calculate the total cfact */
-	for (i = 0; (i < count) && c; c = nexttiled(c->next), i++) {
-		cfacts += c->cfact;
+	for (i = *next, placed = 0; (placed < count) && i < n; i++) {
+		if (varcolcolumn(lm, lc, i) == col) {
+			cfacts += lc[i].cfact;
+			placed++;
+		}
+	}
+
+	if (!placed) {
+		return;
 	}
-	c = nexttiled(first);
 
 	/* 2nd pass to calculate heights taking into account minh and maxh */
-	y = m->wy;
-	for (i = 0; (i < count) && c; c = nexttiled(c->next), i++) {
-		ch = ((wh / cfacts) * c->cfact) - (2 * c->bw);
-
-		if (c->maxh && ch > c->maxh) {
-			c->h = c->maxh;
-		} else if (c->minh && ch < c->minh) {
-			c->h = c->minh;
+	for (i = *next, placed = 0; (placed < count) && i < n; i++) {
+		if (varcolcolumn(lm, lc, i) != col) {
+			continue;
+		}
+		placed++;
+
+		ch = ((wh / cfacts) * lc[i].cfact) - (2 * lc[i].bw);
+
+		if (lc[i].maxh && ch > lc[i].maxh) {
+			r[i].h = lc[i].maxh;
+		} else if (lc[i].minh && ch < lc[i].minh) {
+			r[i].h = lc[i].minh;
 		} else {
-			c->h = 0;
+			r[i].h = 0;
 			continue;
 		}
 
-		cfacts -= c->cfact;
-		wh -= c->h + (2 * c->bw);
+		cfacts -= lc[i].cfact;
+		wh -= r[i].h + (2 * lc[i].bw);
 	}
-	c = nexttiled(first);
 
-	/* 2nd pass to position clients */
-	y = m->wy;
-	for (i = 0; (i < count) && c; c = nexttiled(c->next), i++) {
-		if (c->h) {
-			ch = c->h;
+	/* 3rd pass to position clients */
+	y = lm->wy;
+	for (i = *next, placed = 0; (placed < count) && i < n; i++) {
+		if (varcolcolumn(lm, lc, i) != col) {
+			continue;
+		}
+		placed++;
+
+		if (r[i].h) {
+			ch = r[i].h;
 		} else {
-			ch = ((wh / cfacts) * c->cfact) - (2 * c->bw);
+			ch = ((wh / cfacts) * lc[i].cfact) - (2 * lc[i].bw);
 		}
 
-		cw = w - (2 * c->bw);
-		if (c->maxw && cw > c->maxw) {
+		cw = w - (2 * lc[i].bw);
+		if (lc[i].maxw && cw > lc[i].maxw) {
 			/* Don't make a window bigger than it's max hint size */
-			cw = c->maxw;
-		} else if (c->minw && cw < c->minw) {
-			cw = c->minw;
+			cw = lc[i].maxw;
+		} else if (lc[i].minw && cw < lc[i].minw) {
+			cw = lc[i].minw;
 		}
 
-		resize(c, *x, y, cw, ch, False);
+		r[i] = (LayoutRect){ *x, y, cw, ch, r[i].flags | RectPlaced };
 
-		ch = HEIGHT(c);
-		if (ch < m->wh) {
-			y = c->y + ch;
+		f = layoutfit(lm, &lc[i], r[i]);
+		ch = f.h + (2 * lc[i].bw);
+		if (ch < lm->wh) {
+			y = f.y + ch;
 		}
 	}
 
+	*next = i;
 	(*x) += w;
-
-	return(c);
 }
 
 /*
@@ -173,61 +215,38 @@ static Client * placeColumn(Monitor *m, Client *first, int count, int *x, int w)
 		0-1 small left columns, containing clients that have been "pushed" left
 		1-n master columns
 		0-n right columns
+
+	Clients that have been pushed left are moved to the end of the client list
+	so that they come after the master and right columns.
 */
 void varcol(Monitor *m)
+{
+	layoutapply(m, varcolrects);
+}
+
+static void varcolrects(const LayoutMonitor *lm, const LayoutClient *lc, unsigned int n,
+				LayoutRect *r, char *symbol)
 {
 	int				masterw, leftw, rightw, x;
-	unsigned int	i, leftn, rightn, mastern, coln;
+	unsigned int	i, leftn, rightn, mastern, coln, next;
 	float			colfacts;
-	Client			*c, **end, *next;
-	Client			*left_clients	= NULL;
-	int				nmastercols		= m->nmastercols;
-	int				nrightcols		= m->nrightcols;
-
-	/*
-		Pull off all of the windows which have been pushed to the left, and
-		reattach them at the end of the list.
-	*/
-	end = &left_clients;
-	next = nexttiled(m->clients);
-
-	for (i = 0; (c = next); i++) {
-		/* Calculate the next one here in case we detach */
-		next = nexttiled(c->next);
-
-		if (i < m->nmaster) {
-			/* Master */
-			;
-		} else if (isleft(c)) {
-			/* Left; Detach and put in the left list */
-			detach(c);
-			c->next = NULL;
-
-			*end = c;
-			end = &c->next;
-		}
-	}
-
-	/*
-		Find the end of the client list so that the left windows can be
-		reattached at the end.
-	*/
-	end = &m->clients;
-	while (end && *end) {
-		end = &((*end)->next);
-	}
-	*end = left_clients;
-
+	int				nmastercols		= lm->nmastercols;
+	int				nrightcols		= lm->nrightcols;
 
 	/* Count the windows for each column type */
 	leftn = rightn = mastern = 0;
-	for (c = nexttiled(m->clients); c; c = nexttiled(c->next)) {
-		if (mastern < m->nmaster) {
+	for (i = 0; i < n; i++) {
+		switch (varcolcolumn(lm, lc, i)) {
+		case ColMaster:
 			mastern++;
-		} else if (isleft(c)) {
+			break;
+		case ColLeft:
 			leftn++;
-		} else {
+			r[i].flags |= RectLast;
+			break;
+		default:
 			rightn++;
+			break;
 		}
 	}
 
@@ -244,42 +263,42 @@ void varcol(Monitor *m)
 
 	/* Left column */
 	if (leftn > 0) {
-		colfacts += m->colfact[0];
+		colfacts += lm->colfact[0];
 	}
 
 	/* Center column(s) */
 	for (i = 0; i < nmastercols; i++) {
-		colfacts += m->colfact[1];
+		colfacts += lm->colfact[1];
 	}
 
 	/* Right column(s) */
 	if (rightn > 0) {
 		for (i = 0; i < nrightcols; i++) {
-			colfacts += m->colfact[2];
+			colfacts += lm->colfact[2];
 		}
 	}
 
 	/* Calculate the width for each column type */
-	leftw	= (m->ww / colfacts) * m->colfact[0];
-	masterw	= (m->ww / colfacts) * m->colfact[1];
-	rightw	= (m->ww / colfacts) * m->colfact[2];
+	leftw	= (lm->ww / colfacts) * lm->colfact[0];
+	masterw	= (lm->ww / colfacts) * lm->colfact[1];
+	rightw	= (lm->ww / colfacts) * lm->colfact[2];
 
 
 	/* Master columns; start to the right of the "left" column */
-	c = nexttiled(m->clients);
+	next = 0;
 	coln = floor(mastern / nmastercols);
-	x = m->wx;
+	x = lm->wx;
 	if (leftn > 0) {
 		x += leftw;
 	}
 
 	for (i = 0; i < nmastercols; i++) {
 		if (i < nmastercols - 1) {
-			c = placeColumn(m, c, coln, &x, masterw);
+			placeColumn(lm, lc, n, r, ColMaster, &next, coln, &x, masterw);
 			mastern -= coln;
 		} else {
 			/* Remainder goes into the last master column */
-			c = placeColumn(m, c, mastern, &x, masterw);
+			placeColumn(lm, lc, n, r, ColMaster, &next, mastern, &x, masterw);
 		}
 	}
 
@@ -289,19 +308,20 @@ void varcol(Monitor *m)
 
 		for (i = 0; i < nrightcols; i++) {
 			if (i < nrightcols - 1) {
-				c = placeColumn(m, c, coln, &x, rightw);
+				placeColumn(lm, lc, n, r, ColRight, &next, coln, &x, rightw);
 				rightn -= coln;
 			} else {
 				/* Remainder goes into the last right column */
-				c = placeColumn(m, c, rightn, &x, rightw);
+				placeColumn(lm, lc, n, r, ColRight, &next, rightn, &x, rightw);
 			}
 		}
 	}
 
 	/* left column */
 	if (leftn > 0) {
-		x = m->wx;
-		c = placeColumn(m, c, leftn, &x, leftw);
+		x = lm->wx;
+		next = 0;
+		placeColumn(lm, lc, n, r, ColLeft, &next, leftn, &x, leftw);
 	}
 }
 
@@ -310,7 +330,7 @@ void varcol(Monitor *m)
 */
 void incncols(const Arg *arg)
 {
-	if (!arg || !selmon || !selmon->lt[selmon->sellt]->arrange || !selmon->sel) {
+	if (!arg || !selmon || !ISTILED(selmon) || !selmon->sel) {
 		return;
 	}
 
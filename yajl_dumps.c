@@ -104,6 +104,7 @@ dump_monitor(yajl_gen gen, Monitor *mon, int is_selected)
     YSTR("num_master"); YINT(mon->nmaster);
     YSTR("num"); YINT(mon->num);
     YSTR("is_selected"); YBOOL(is_selected);
+    YSTR("generation"); YINT(mon->ipcgen);
 
     YSTR("monitor_geometry"); YMAP(
       YSTR("x"); YINT(mon->mx);
@@ -178,6 +179,37 @@ dump_monitors(yajl_gen gen, Monitor *mons, Monitor *selmon)
   return 0;
 }
 
+int
+dump_monitors_delta(yajl_gen gen, Monitor *mons, Monitor *selmon,
+                    const unsigned long generation, const unsigned long since)
+{
+  // clang-format off
+  YMAP(
+    YSTR("generation"); YINT(generation);
+    YSTR("modified"); YBOOL(since < generation);
+    if (since < generation) {
+      YSTR("monitor_numbers"); YARR(
+        for (Monitor *mon = mons; mon; mon = mon->next)
+          YINT(mon->num);
+      )
+      YSTR("monitors"); YARR(
+        for (Monitor *mon = mons; mon; mon = mon->next)
+          if (mon->ipcgen > since)
+            dump_monitor(gen, mon, mon == selmon);
+      )
+      YSTR("clients"); YARR(
+        for (Monitor *mon = mons; mon; mon = mon->next)
+          for (Client *c = mon->clients; c; c = c->next)
+            if (c->ipcgen > since)
+              dump_client(gen, c);
+      )
+    }
+  )
+  // clang-format on
+
+  return 0;
+}
+
 int
 dump_layouts(yajl_gen gen, const Layout layouts[], const int layouts_len)
 {
@@ -197,6 +229,44 @@ dump_layouts(yajl_gen gen, const Layout layouts[], const int layouts_len)
   return 0;
 }
 
+int
+dump_stats(yajl_gen gen, const Stats *stats)
+{
+  // clang-format off
+  YMAP(
+    YSTR("configure"); YMAP(
+      YSTR("issued"); YINT(stats->configissued);
+      YSTR("skipped"); YINT(stats->configskipped);
+    )
+  )
+  // clang-format on
+
+  return 0;
+}
+
+int
+dump_ipc_clients(yajl_gen gen, IPCClientList clients)
+{
+  // clang-format off
+  YARR(
+    for (IPCClient *c = clients; c; c = c->next) {
+      YMAP(
+        YSTR("fd"); YINT(c->fd);
+        YSTR("subscriptions"); YINT(c->subscriptions);
+        YSTR("monitor"); YINT(c->monitor);
+        YSTR("fields"); YINT(c->fields);
+        YSTR("queued_messages"); YINT(c->queue_len);
+        YSTR("queued_bytes"); YINT(c->queue_bytes);
+        YSTR("total_bytes_queued"); YINT(c->bytes_queued);
+        YSTR("events_dropped"); YINT(c->events_dropped);
+      )
+    }
+  )
+  // clang-format on
+
+  return 0;
+}
+
 int
 dump_tag_state(yajl_gen gen, TagState state)
 {
@@ -281,6 +351,20 @@ dump_monitor_focus_change_event(yajl_gen gen, const int last_mon_num,
   return 0;
 }
 
+int
+dump_state_change_event(yajl_gen gen, const uint32_t sequence)
+{
+  // clang-format off
+  YMAP(
+    YSTR("state_change_event"); YMAP(
+      YSTR("sequence"); YINT(sequence);
+    )
+  )
+  // clang-format on
+
+  return 0;
+}
+
 int
 dump_focused_title_change_event(yajl_gen gen, const int mon_num,
                                 const Window client_id, const char *old_name,
@@ -32,8 +32,16 @@ int dump_monitor(yajl_gen gen, Monitor *mon, int is_selected);
 
 int dump_monitors(yajl_gen gen, Monitor *mons, Monitor *selmon);
 
+int dump_monitors_delta(yajl_gen gen, Monitor *mons, Monitor *selmon,
+                        const unsigned long generation,
+                        const unsigned long since);
+
 int dump_layouts(yajl_gen gen, const Layout layouts[], const int layouts_len);
 
+int dump_stats(yajl_gen gen, const Stats *stats);
+
+int dump_ipc_clients(yajl_gen gen, IPCClientList clients);
+
 int dump_tag_state(yajl_gen gen, TagState state);
 
 int dump_tag_event(yajl_gen gen, int mon_num, TagState old_state,
@@ -49,6 +57,8 @@ int dump_layout_change_event(yajl_gen gen, const int mon_num,
 int dump_monitor_focus_change_event(yajl_gen gen, const int last_mon_num,
                                     const int new_mon_num);
 
+int dump_state_change_event(yajl_gen gen, const uint32_t sequence);
+
 int dump_focused_title_change_event(yajl_gen gen, const int mon_num,
                                     const Window client_id,
                                     const char *old_name, const char *new_name);